@@ -3,8 +3,8 @@
 // Builds a 20-node graph, runs Dijkstra and simple K-shortest (Yen-lite),
 // explains why alternatives are worse, and writes path.json for viewer.
 //
-// Compile: g++ -std=c++17 main.cpp -O2 -o safepath
-// Run example: ./safepath Koramangala "MG Road" 3
+// Compile: g++ -std=c++17 main.cpp -O2 -pthread -o safepath
+// Run example: ./safepath Koramangala "MG Road" 3 [--stats]
 //
 // Arguments:
 //   start_name (string) - node name (e.g., "Koramangala")
@@ -35,12 +35,39 @@ static vector<NodeInfo> NODES;
 static vector<vector<Edge>> G;
 static int EDGE_COUNTER = 0;
 
+// Search instrumentation (--stats): dijkstra() keeps local counters and only
+// adds them here when enabled; phases are wall times in milliseconds
+struct SearchStats { long long searches=0, settled=0, relaxed=0, pushes=0, pops=0, stale_pops=0; };
+static bool STATS_ON = false;
+static SearchStats STATS;
+static mutex STATS_MU; // spur searches run on several threads
+static double T_SEARCH_MS = 0, T_KPATHS_MS = 0, T_OUTPUT_MS = 0;
+static chrono::steady_clock::time_point T_OUTPUT_T0; // printing routes starts the output phase
+static double ms_between(chrono::steady_clock::time_point a, chrono::steady_clock::time_point b) {
+    return chrono::duration<double, milli>(b - a).count();
+}
+
 // Helper: add undirected edge
 void add_edge(int u, int v, double meters) {
     G[u].push_back({v, meters, EDGE_COUNTER++});
     G[v].push_back({u, meters, EDGE_COUNTER++});
 }
 
+// Collapse parallel roads (some links are added twice below): per direction keep
+// only the shortest edge, so searches and K-paths don't relax duplicates
+void collapse_parallel_edges() {
+    for (auto &lst : G) {
+        unordered_map<int,int> pos; // to -> index in kept
+        vector<Edge> kept;
+        for (auto &e : lst) {
+            auto it = pos.find(e.to);
+            if (it == pos.end()) { pos[e.to] = (int)kept.size(); kept.push_back(e); }
+            else if (e.w < kept[it->second].w) kept[it->second] = e;
+        }
+        lst.swap(kept);
+    }
+}
+
 // Dijkstra - returns distance and parent arrays (parent[v] = previous node)
 double dijkstra(int s, int t, const unordered_set<int>& forbiddenEdgeIds, vector<int>& parent) {
     const double INF = 1e18;
@@ -51,14 +78,17 @@ double dijkstra(int s, int t, const unordered_set<int>& forbiddenEdgeIds, vector
     priority_queue<P, vector<P>, greater<P>> pq;
     dist[s] = 0;
     pq.push({0, s});
+    long long settled = 0, relaxed = 0, pushes = 1, pops = 0;
     while (!pq.empty()) {
         auto top = pq.top();
         pq.pop();
+        pops++;
     
         double d = top.first;
         int u = top.second;
     
         if (d > dist[u]) continue;
+        settled++;
         if (u == t) break;
     
         for (auto &e : G[u]) {
@@ -66,14 +96,21 @@ double dijkstra(int s, int t, const unordered_set<int>& forbiddenEdgeIds, vector
     
             int v = e.to;
             double nd = d + e.w;
+            relaxed++;
     
             if (nd + 1e-9 < dist[v]) {
                 dist[v] = nd;
                 parent[v] = u;
                 pq.push(std::make_pair(nd, v));
+                pushes++;
             }
         }
     }
+    if (STATS_ON) {
+        lock_guard<mutex> lk(STATS_MU);
+        STATS.searches++; STATS.settled += settled; STATS.relaxed += relaxed;
+        STATS.pushes += pushes; STATS.pops += pops; STATS.stale_pops += pops - settled;
+    }
     
     return dist[t];
 }
@@ -109,7 +146,10 @@ vector<PathInfo> yen_lite_k_shortest(int s, int t, int K) {
     vector<PathInfo> results;
     unordered_set<int> emptySet;
     vector<int> parent;
+    chrono::steady_clock::time_point t0, t1;
+    if (STATS_ON) t0 = chrono::steady_clock::now();
     double bestd = dijkstra(s,t,emptySet,parent);
+    if (STATS_ON) { t1 = chrono::steady_clock::now(); T_SEARCH_MS += ms_between(t0, t1); }
     if (bestd >= 1e17) return results;
     vector<int> bestpath = build_path_from_parent(t,parent);
     results.push_back(compute_path_info(bestpath));
@@ -120,26 +160,40 @@ vector<PathInfo> yen_lite_k_shortest(int s, int t, int K) {
         // generate candidates by removing one edge from each path in results (or just from best)
         // We'll remove edges from the best path only and from subsequent ones generated as practical (simple method)
         vector<int> basePath = results.back().nodes; // start expanding from latest found path for variety
-        for (size_t i=0;i+1<basePath.size();++i) {
-            int a = basePath[i], b = basePath[i+1];
-            // find edge ids for edge a->b (could be multiple; forbid all matching a->b)
-            unordered_set<int> forb;
-            for (auto &e : G[a]) if (e.to == b) forb.insert(e.id);
-            vector<int> parent2;
-            double d2 = dijkstra(s,t,forb,parent2);
-            if (d2 < 1e17) {
-                vector<int> p2 = build_path_from_parent(t,parent2);
-                // avoid adding same as any already in results
-                bool duplicate=false;
-                for(auto &r: results) if (r.nodes==p2) { duplicate=true; break; }
-                if (!duplicate) candidates.insert({d2,p2});
+        // spur searches only read G and carry their own forbidden set, so they run on worker threads
+        size_t spurs = basePath.size() - 1;
+        vector<pair<double, vector<int>>> found(spurs, {1e18, {}});
+        atomic<size_t> next{0};
+        auto worker = [&]() {
+            size_t i;
+            while ((i = next++) < spurs) {
+                int a = basePath[i], b = basePath[i+1];
+                // find edge ids for edge a->b (could be multiple; forbid all matching a->b)
+                unordered_set<int> forb;
+                for (auto &e : G[a]) if (e.to == b) forb.insert(e.id);
+                vector<int> parent2;
+                double d2 = dijkstra(s,t,forb,parent2);
+                if (d2 < 1e17) found[i] = {d2, build_path_from_parent(t,parent2)};
             }
+        };
+        size_t T = min<size_t>(max(1u, thread::hardware_concurrency()), spurs);
+        vector<thread> pool;
+        for (size_t w=1; w<T; ++w) pool.emplace_back(worker);
+        worker();
+        for (auto &th : pool) th.join();
+        for (auto &f : found) {
+            if (f.first >= 1e17) continue;
+            // avoid adding same as any already in results
+            bool duplicate=false;
+            for(auto &r: results) if (r.nodes==f.second) { duplicate=true; break; }
+            if (!duplicate) candidates.insert(f);
         }
         if (candidates.empty()) break;
         auto it = candidates.begin();
         results.push_back(compute_path_info(it->second));
         candidates.erase(it);
     }
+    if (STATS_ON) T_KPATHS_MS += ms_between(t1, chrono::steady_clock::now());
     return results;
 }
 
@@ -229,7 +283,14 @@ void write_path_json(const vector<PathInfo>& routes, const string& outfn) {
         if (i+1<routes.size()) fo << ",";
         fo << "\n";
     }
-    fo << "  ]\n}\n";
+    fo << "  ]";
+    if (STATS_ON) {
+        fo << ",\n  \"stats\": {\"searches\": " << STATS.searches << ", \"settled_nodes\": " << STATS.settled
+           << ", \"relaxed_edges\": " << STATS.relaxed << ", \"heap_pushes\": " << STATS.pushes << ", \"heap_pops\": " << STATS.pops
+           << ", \"stale_pops\": " << STATS.stale_pops << ", \"search_ms\": " << T_SEARCH_MS << ", \"kpaths_ms\": " << T_KPATHS_MS
+           << ", \"output_ms\": " << ms_between(T_OUTPUT_T0, chrono::steady_clock::now()) << "}"; // output up to here
+    }
+    fo << "\n}\n";
     fo.close();
     cout << "Wrote " << outfn << " with " << routes.size() << " route(s).\n";
 }
@@ -311,10 +372,18 @@ int main(int argc, char** argv) {
     add_edge(16, 0, m(4.8)); // Bellandur - Koramangala
     add_edge(2, 11, m(8.0)); // MG Road - Marathahalli (east link)
     add_edge(14, 13, m(3.2)); // Majestic - Rajajinagar (quick link)
+    collapse_parallel_edges();
 
-    // Parse arguments
+    // Parse arguments (--stats may appear anywhere)
+    vector<char*> pos{argv[0]};
+    for (int i=1;i<argc;++i) {
+        if (string(argv[i]) == "--stats") STATS_ON = true;
+        else pos.push_back(argv[i]);
+    }
+    argc = (int)pos.size();
+    argv = pos.data();
     if (argc < 3) {
-        cout << "Usage: " << argv[0] << " <start_name> <dest_name> [K]\n";
+        cout << "Usage: " << argv[0] << " <start_name> <dest_name> [K] [--stats]\n";
         cout << "Available nodes:\n";
         for (size_t i=0;i<NODES.size();++i) cout << "  " << NODES[i].name << "\n";
         return 0;
@@ -342,6 +411,7 @@ int main(int argc, char** argv) {
     }
 
     // Print routes + reasons
+    if (STATS_ON) T_OUTPUT_T0 = chrono::steady_clock::now();
     cout << fixed << setprecision(2);
     cout << "\nTop " << routes.size() << " routes from " << startName << " -> " << destName << ":\n";
     for (size_t i=0;i<routes.size();++i) {
@@ -362,6 +432,12 @@ int main(int argc, char** argv) {
 
     // write path.json for viewer; include up to K (we'll write all computed routes)
     write_path_json(routes, "path.json");
+    if (STATS_ON) {
+        T_OUTPUT_MS = ms_between(T_OUTPUT_T0, chrono::steady_clock::now());
+        cerr << "stats: searches=" << STATS.searches << " settled=" << STATS.settled << " relaxed=" << STATS.relaxed
+             << " pushes=" << STATS.pushes << " pops=" << STATS.pops << " stale_pops=" << STATS.stale_pops << "\n";
+        cerr << "stats: search=" << T_SEARCH_MS << "ms kpaths=" << T_KPATHS_MS << "ms output=" << T_OUTPUT_MS << "ms\n";
+    }
 
     cout << "\nOpen viewer/index.html in your browser (or run a local server) to visualize path.json\n";
     return 0;
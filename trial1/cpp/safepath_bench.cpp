@@ -0,0 +1,788 @@
+// safepath_bench.cpp
+// Synthetic graph generators + timing harness for the safepath_core engine.
+// Compile: g++ -std=c++17 safepath_bench.cpp -O2 -pthread -I.. -o safepath_bench
+// Usage:
+//   ./safepath_bench gen <grid|geo|road> N outdir [seed]       write nodes.csv, edges.csv, updates.json
+//   ./safepath_bench run <grid|geo|road> N [queries] [K] [seed] generate into bench_<kind>_<N>/ and time it
+//   ./safepath_bench dir <datadir> [queries] [K] [seed]        time an existing data directory
+//   ./safepath_bench check                                     run the small correctness cases
+//   --threads N runs the spur searches of k_short_simple on N threads
+//   --phast also builds a contraction hierarchy and times PHAST against a full one-to-all
+//   Dijkstra (the hierarchy build takes seconds per 100k nodes, so it is opt-in)
+//   --history also compresses 256 synthetic traffic slots and times decoding one
+//   (the store build is heavy at the 10M-edge end, so it is opt-in too)
+// Sizes from 1k to 10M nodes; N accepts suffixes k and M (e.g. 100k, 10M).
+#define SAFEPATH_NO_MAIN
+#include "safepath_core.cpp"
+#include <chrono>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using bench_clock = chrono::steady_clock;
+static bool bench_phast = false, bench_history = false;
+static double ms_since(bench_clock::time_point t0) {
+    return chrono::duration<double, milli>(bench_clock::now() - t0).count();
+}
+
+// ---------------------------------------------------------------- generators
+
+struct GenNode { double lat, lon; string name; };
+struct GenEdge { int u, v; double dist, t, rq, si; bool oneway; };
+
+static double haversine_m(double lat1, double lon1, double lat2, double lon2) {
+    const double R = 6371000.0, rad = M_PI / 180.0;
+    double dphi = (lat2-lat1)*rad, dl = (lon2-lon1)*rad;
+    double a = sin(dphi/2)*sin(dphi/2) + cos(lat1*rad)*cos(lat2*rad)*sin(dl/2)*sin(dl/2);
+    return R * 2 * atan2(sqrt(a), sqrt(1-a));
+}
+
+// edge attributes in the ranges fetch_place_and_route.py produces; speed in m/s
+static GenEdge make_edge(const vector<GenNode> &ns, int u, int v, double speed, mt19937_64 &rng, bool oneway=false) {
+    uniform_real_distribution<double> q(4.0, 9.5), detour(1.0, 1.25);
+    double d = max(1.0, haversine_m(ns[u].lat, ns[u].lon, ns[v].lat, ns[v].lon) * detour(rng));
+    return {u, v, d, d / speed, q(rng), q(rng), oneway};
+}
+
+static const char* STREETS[] = {"MG Road","Hosur Road","Outer Ring Road","Bellary Road","Old Airport Road",
+    "Sarjapur Road","Bannerghatta Road","Tumkur Road","Mysore Road","Kanakapura Road","Old Madras Road","Hennur Road"};
+
+// jittered W x H lattice, every cell joined to its right and lower neighbour
+static void gen_grid(long long N, mt19937_64 &rng, vector<GenNode> &ns, vector<GenEdge> &es) {
+    int W = max(2, (int)sqrt((double)N)), H = max(2, (int)((N + W - 1) / W));
+    uniform_real_distribution<double> jit(-0.0003, 0.0003), sp(8.0, 14.0);
+    ns.resize((size_t)W*H);
+    for(int y=0;y<H;++y) for(int x=0;x<W;++x)
+        ns[(size_t)y*W+x] = {12.80 + y*0.001 + jit(rng), 77.45 + x*0.001 + jit(rng), ""};
+    for(int y=0;y<H;++y) for(int x=0;x<W;++x){
+        int i = y*W+x;
+        if(x+1<W) es.push_back(make_edge(ns, i, i+1, sp(rng), rng));
+        if(y+1<H) es.push_back(make_edge(ns, i, i+W, sp(rng), rng));
+    }
+}
+
+// random geometric graph: uniform points, joined to every point within radius r
+// (r chosen for ~6 neighbours on average), found through a bucket grid
+static void gen_geo(long long N, mt19937_64 &rng, vector<GenNode> &ns, vector<GenEdge> &es) {
+    uniform_real_distribution<double> U(0.0, 1.0), sp(8.0, 14.0);
+    double side = sqrt((double)N) * 0.001; // ~110 m between neighbours, like the grid
+    double r = sqrt(6.0 / (M_PI * N));
+    int C = max(1, (int)(1.0 / r));
+    vector<double> px(N), py(N);
+    vector<vector<int>> cell((size_t)C*C);
+    ns.resize(N);
+    for(long long i=0;i<N;++i){
+        px[i] = U(rng); py[i] = U(rng);
+        ns[i] = {12.80 + py[i]*side, 77.45 + px[i]*side, ""};
+        cell[min(C-1,(int)(py[i]*C))*(size_t)C + min(C-1,(int)(px[i]*C))].push_back((int)i);
+    }
+    for(long long i=0;i<N;++i){
+        int cx = min(C-1,(int)(px[i]*C)), cy = min(C-1,(int)(py[i]*C));
+        for(int dy=-1;dy<=1;++dy) for(int dx=-1;dx<=1;++dx){
+            int x = cx+dx, y = cy+dy;
+            if(x<0||y<0||x>=C||y>=C) continue;
+            for(int j : cell[(size_t)y*C+x]){
+                if(j <= i) continue;
+                double ddx = px[i]-px[j], ddy = py[i]-py[j];
+                if(ddx*ddx + ddy*ddy <= r*r) es.push_back(make_edge(ns, (int)i, j, sp(rng), rng));
+            }
+        }
+    }
+}
+
+// road-like: a lattice of named intersections whose streets are split into
+// chains of unnamed OSRM-style step nodes (segN), fast arterials every 5th
+// line, ~10% oneway streets and ~5% missing links
+static void gen_road(long long N, mt19937_64 &rng, vector<GenNode> &ns, vector<GenEdge> &es) {
+    const int avg_steps = 2; // interior nodes per street on average
+    int G = max(2, (int)sqrt((double)N / (1 + 2*avg_steps)));
+    uniform_real_distribution<double> U(0.0, 1.0), jit(-0.0004, 0.0004);
+    uniform_int_distribution<int> steps(0, 2*avg_steps);
+    double cell = 0.004;
+    ns.reserve(N + N/8);
+    for(int y=0;y<G;++y) for(int x=0;x<G;++x){
+        const char *st = STREETS[(x/5 + y/5) % (sizeof(STREETS)/sizeof(*STREETS))];
+        ns.push_back({12.80 + y*cell + jit(rng), 77.45 + x*cell + jit(rng), string(st) + " Junction " + to_string(y % 50)});
+    }
+    auto street = [&](int a, int b, bool arterial){
+        if(U(rng) < 0.05) return;
+        int k = steps(rng);
+        bool ow = !arterial && U(rng) < 0.10;
+        double speed = arterial ? 16.0 : 9.0;
+        int prev = a;
+        for(int s=1;s<=k;++s){
+            double f = (double)s/(k+1);
+            int id = ns.size();
+            ns.push_back({ns[a].lat + (ns[b].lat-ns[a].lat)*f + jit(rng)/4, ns[a].lon + (ns[b].lon-ns[a].lon)*f + jit(rng)/4, "seg" + to_string(id)});
+            es.push_back(make_edge(ns, prev, id, speed, rng, ow));
+            prev = id;
+        }
+        es.push_back(make_edge(ns, prev, b, speed, rng, ow));
+    };
+    for(int y=0;y<G;++y) for(int x=0;x<G;++x){
+        int i = y*G+x;
+        if(x+1<G) street(i, i+1, y%5 == 0);
+        if(y+1<G) street(i, i+G, x%5 == 0);
+    }
+}
+
+static bool write_dataset(const string &dir, const vector<GenNode> &ns, const vector<GenEdge> &es, mt19937_64 &rng) {
+    mkdir(dir.c_str(), 0755);
+    FILE *fn = fopen((dir + "/nodes.csv").c_str(), "w");
+    FILE *fe = fopen((dir + "/edges.csv").c_str(), "w");
+    FILE *fu = fopen((dir + "/updates.json").c_str(), "w");
+    if(!fn || !fe || !fu) return false;
+    static char buf[3][1<<20];
+    setvbuf(fn, buf[0], _IOFBF, sizeof(buf[0])); setvbuf(fe, buf[1], _IOFBF, sizeof(buf[1])); setvbuf(fu, buf[2], _IOFBF, sizeof(buf[2]));
+    fprintf(fn, "id,name,lat,lon\n");
+    for(size_t i=0;i<ns.size();++i)
+        fprintf(fn, "%zu,\"%s\",%.6f,%.6f\n", i, ns[i].name.empty() ? ("seg" + to_string(i)).c_str() : ns[i].name.c_str(), ns[i].lat, ns[i].lon);
+    fprintf(fe, "u,v,distance_m,freeflow_time_s,road_quality,safety_index,edge_id,oneway\n");
+    for(size_t i=0;i<es.size();++i)
+        fprintf(fe, "%d,%d,%.2f,%.2f,%.2f,%.2f,%zu,%d\n", es[i].u, es[i].v, es[i].dist, es[i].t, es[i].rq, es[i].si, i, (int)es[i].oneway);
+    // same shape as fetch_place_and_route.py + simulate_updates.py ticks
+    uniform_real_distribution<double> U(0.0, 1.0);
+    fprintf(fu, "{");
+    for(size_t i=0;i<es.size();++i){
+        bool hot = U(rng) < 0.1;
+        fprintf(fu, "%s\"%zu\":{\"traffic_multiplier\":%.2f,\"rain_mm_hr\":%.2f,\"road_quality_adjust\":%.2f,\"blocked\":%s}",
+            i ? "," : "", i, hot ? 1.0 + 2.0*U(rng) : 1.0, hot ? 12.0*U(rng) : 0.0, hot ? -2.0 + 3.0*U(rng) : 0.0, U(rng) < 0.002 ? "true" : "false");
+    }
+    fprintf(fu, "}\n");
+    fclose(fn); fclose(fe); fclose(fu);
+    return true;
+}
+
+static long long parse_count(const string &s) {
+    double v = stod(s);
+    char c = s.empty() ? 0 : s.back();
+    if(c == 'k' || c == 'K') v *= 1e3;
+    if(c == 'm' || c == 'M') v *= 1e6;
+    return (long long)v;
+}
+
+static bool generate(const string &kind, long long N, const string &dir, uint64_t seed) {
+    mt19937_64 rng(seed);
+    vector<GenNode> ns; vector<GenEdge> es;
+    auto t0 = bench_clock::now();
+    if(kind == "grid") gen_grid(N, rng, ns, es);
+    else if(kind == "geo") gen_geo(N, rng, ns, es);
+    else if(kind == "road") gen_road(N, rng, ns, es);
+    else { cerr << "unknown generator " << kind << " (grid|geo|road)\n"; return false; }
+    double gen_ms = ms_since(t0);
+    t0 = bench_clock::now();
+    if(!write_dataset(dir, ns, es, rng)) { cerr << "cannot write into " << dir << "\n"; return false; }
+    cerr << "gen " << kind << ": " << ns.size() << " nodes, " << es.size() << " edges in " << fixed << setprecision(1)
+         << gen_ms << " ms, written to " << dir << "/ in " << ms_since(t0) << " ms\n";
+    return true;
+}
+
+// ---------------------------------------------------------------- timing
+
+struct Samples {
+    vector<double> ms;
+    void add(double x) { ms.push_back(x); }
+    double pct(double p) {
+        if(ms.empty()) return 0.0;
+        sort(ms.begin(), ms.end());
+        return ms[min(ms.size()-1, (size_t)(p/100.0 * ms.size()))];
+    }
+    double total() const { return accumulate(ms.begin(), ms.end(), 0.0); }
+};
+
+static void report(const string &what, Samples &s, const string &unit_note = "") {
+    double tot = s.total();
+    printf("%-14s n=%-6zu p50=%9.3f p90=%9.3f p99=%9.3f max=%9.3f ms  %8.1f q/s %s\n", what.c_str(), s.ms.size(),
+           s.pct(50), s.pct(90), s.pct(99), s.pct(100), tot > 0 ? 1000.0 * s.ms.size() / tot : 0.0, unit_note.c_str());
+}
+
+static int run_dir(const string &dir, int queries, int K, uint64_t seed) {
+    reset_graph();
+    auto t0 = bench_clock::now();
+    if(!load_nodes(dir + "/nodes.csv")) { cerr << "Cannot load nodes\n"; return 1; }
+    double t_nodes = ms_since(t0); t0 = bench_clock::now();
+    if(!load_edges(dir + "/edges.csv")) { cerr << "Cannot load edges\n"; return 1; }
+    double t_edges = ms_since(t0); t0 = bench_clock::now();
+    if(!load_updates(dir + "/updates.json")) { cerr << "Cannot load updates\n"; return 1; }
+    double t_updates = ms_since(t0); t0 = bench_clock::now();
+    compile_costs();
+    double t_compile = ms_since(t0); t0 = bench_clock::now();
+    rebuild_graph();
+    double t_csr = ms_since(t0); t0 = bench_clock::now();
+    apply_cost_weights(current_weights(), sedge_cost); // weight change only: cost kernel over the term columns
+    double t_reweight = ms_since(t0);
+
+    printf("graph %s: %zu nodes (%zu unique names, %zu name bytes), %zu edges, %zu arcs\n", dir.c_str(),
+           nodes.size(), names.size(), names.buf.size(), edges.size(), adj.arcs.size());
+    printf("load           nodes %.1f ms (%.2f M/s) | edges %.1f ms (%.2f M/s) | updates %.1f ms | cost compile %.1f ms | CSR rebuild %.1f ms\n",
+           t_nodes, nodes.size() / max(t_nodes, 1e-9) / 1e3, t_edges, edges.size() / max(t_edges, 1e-9) / 1e3, t_updates, t_compile, t_csr);
+    printf("reweight       %.2f ms (%s kernel, %.0f M search edges/s)\n", t_reweight, cost_kernel().second, sedge_cost.size() / max(t_reweight, 1e-9) / 1e3);
+
+    // query endpoints from the largest weak component so most queries have an answer
+    int big = max_element(comp_size.begin(), comp_size.end()) - comp_size.begin();
+    vector<int> pool;
+    for(size_t v=0; v<comp_id.size(); ++v) if(comp_id[v] == big) pool.push_back(v);
+    mt19937_64 rng(seed);
+    auto pick = [&]{ return pool[rng() % pool.size()]; };
+
+    Samples sp, ks, out;
+    size_t found = 0, settled_hops = 0;
+    for(int q=0; q<queries; ++q){
+        int s = pick(), t = pick();
+        t0 = bench_clock::now();
+        auto p = dijkstra_path(s, t);
+        sp.add(ms_since(t0));
+        if(!p.empty()) { found++; settled_hops += p.size()-1; }
+    }
+    int kq = max(1, queries / 20); // K-paths run one search per hop of the base path
+    vector<vector<vector<int>>> kroutes;
+    for(int q=0; q<kq; ++q){
+        int s = pick(), t = pick();
+        t0 = bench_clock::now();
+        kroutes.push_back(k_short_simple(s, t, K));
+        ks.add(ms_since(t0));
+    }
+    string tmp = dir + "/bench_path.json";
+    for(auto &r : kroutes){
+        if(r.empty()) continue;
+        t0 = bench_clock::now();
+        streambuf *old = cout.rdbuf(nullptr); // silence "Wrote ..."
+        write_path_json(r, tmp);
+        cout.rdbuf(old);
+        out.add(ms_since(t0));
+    }
+    remove(tmp.c_str());
+
+    // one-to-all: full Dijkstra against PHAST over a contraction hierarchy
+    double t_ch = 0;
+    Samples fd, ph;
+    if(bench_phast) {
+        t0 = bench_clock::now();
+        build_ch();
+        t_ch = ms_since(t0);
+    }
+    vector<int> all(bench_phast ? adj.size() : 0);
+    iota(all.begin(), all.end(), 0);
+    MatrixTargets every = matrix_targets(all);
+    vector<double> dist, row(adj.size());
+    for(int q=0; bench_phast && q<kq; ++q){
+        int s = pick();
+        fill(row.begin(), row.end(), numeric_limits<double>::infinity());
+        t0 = bench_clock::now();
+        one_to_many(local_workspace(), s, every, row.data());
+        fd.add(ms_since(t0));
+        t0 = bench_clock::now();
+        phast(local_workspace(), s, dist);
+        ph.add(ms_since(t0));
+        for(size_t v=0; v<row.size(); ++v)
+            if(!(fabs(dist[v] - row[v]) <= 1e-6 * max(1.0, row[v]) || (isinf(dist[v]) && isinf(row[v])))) { fprintf(stderr, "phast mismatch from node %d\n", s); break; }
+    }
+    report("dijkstra_path", sp, "(" + to_string(found) + " found, avg " + to_string(found ? settled_hops / found : 0) + " hops)");
+    report("k_short K=" + to_string(K), ks, engine_pool ? "(" + to_string(engine_pool->size()) + " threads)" : "");
+    report("write_path", out);
+
+    // cost policies on the same pairs: the compiled column against terms evaluated
+    // inside the search loop, runtime-masked (generic) vs template-specialized
+    vector<pair<int,int>> pairs;
+    for(int q=0; q<queries; ++q) pairs.push_back({pick(), pick()});
+    CostWeights w = current_weights(), no_rain = w;
+    no_rain.weather = 0;
+    auto time_policy = [&](const char *what, const auto &cost, vector<vector<int>> *paths = nullptr){
+        Samples smp;
+        for(auto &pr : pairs){
+            t0 = bench_clock::now();
+            auto p = dijkstra_search(local_workspace(), pr.first, pr.second, {}, cost);
+            smp.add(ms_since(t0));
+            if(paths) paths->push_back(move(p));
+        }
+        report(what, smp);
+    };
+    vector<vector<int>> p_compiled, p_composite;
+    time_policy("cost compiled", CompiledCost{sedge_cost.data()}, &p_compiled);
+    time_policy("cost generic", GenericCost{&cost_terms, w, T_ALL});
+    time_policy("cost <all>", CompositeCost{&cost_terms, w}, &p_composite);
+    if(p_compiled != p_composite) fprintf(stderr, "composite policy disagrees with the compiled column\n");
+    time_policy("generic -rain", GenericCost{&cost_terms, no_rain, term_mask(no_rain)});
+    time_policy("cost <-rain>", TermCost<T_ALL & ~T_RAIN>{&cost_terms, no_rain});
+    time_policy("generic dist", GenericCost{&cost_terms, w, T_DIST});
+    time_policy("cost <dist>", DistanceCost{&cost_terms, w});
+    time_policy("cost time", TimeCost{sedge_time.data(), cost_terms.blocked.data()});
+    if(bench_phast) {
+        report("one_to_all", fd);
+        char note[96];
+        snprintf(note, sizeof note, "(hierarchy %.0f ms, %zu shortcuts)", t_ch, ch.shortcuts);
+        report("phast", ph, note);
+    }
+
+    if(!bench_history) return 0;
+    // historical traffic: compress synthetic hourly slots (a random walk with
+    // ~5% of edges moving per slot), then time decoding one slot and switching
+    // the cost columns to it, against the full compile from updates.json above
+    const uint32_t slots = 256;
+    string store = dir + "/bench_history.sph";
+    vector<int> walk(edges.size(), 256);
+    mt19937_64 hr(seed);
+    size_t bytes = 0;
+    t0 = bench_clock::now();
+    bool built = write_history(store, slots, [&](uint32_t, vector<float> &mul){
+        for(size_t e=0;e<walk.size();++e){
+            if(hr() % 20 == 0) walk[e] = clamp<int>(walk[e] + (int)(hr() % 129) - 64, 128, 1024);
+            mul[e] = walk[e] / 256.0f;
+        }
+        return true;
+    }, &bytes);
+    double t_build = ms_since(t0);
+    HistoryStore hs;
+    Samples dec, app;
+    vector<float> mul;
+    bool opened = built && hs.open(store);
+    for(int q=0; opened && q<20; ++q){
+        t0 = bench_clock::now();
+        hs.slice((uint32_t)(hr() % slots), mul);
+        dec.add(ms_since(t0));
+        t0 = bench_clock::now();
+        traffic_slice = mul; // the store was written in edge index order
+        apply_traffic_slice();
+        app.add(ms_since(t0));
+    }
+    traffic_slice.clear();
+    remove(store.c_str());
+    printf("history        %u slots x %zu edges: %zu bytes (%.1fx smaller than float32), built in %.0f ms\n", slots, edges.size(),
+           bytes, (double)slots * edges.size() * 4 / max<size_t>(bytes, 1), t_build);
+    report("history slice", dec);
+    report("apply slice", app, "(cost compile " + to_string((int)round(t_compile)) + " ms)");
+    return 0;
+}
+
+// ---------------------------------------------------------------- checks
+
+// small hand-made cases for behaviour the timing runs cannot see; each prints
+// ok/FAIL and the run exits non-zero if any failed
+static string check_dir;
+static int check_failures = 0;
+
+static void check(const string &what, bool ok) {
+    printf("check %-40s %s\n", what.c_str(), ok ? "ok" : "FAIL");
+    if(!ok) check_failures++;
+}
+
+static string check_file(const string &name, const string &text) {
+    string path = check_dir + "/" + name;
+    ofstream(path) << text;
+    return path;
+}
+
+// lay out nodes in a row and load them with these edges; blocked lists edge indices
+static void load_check_graph(int n, const vector<GenEdge> &es, const vector<int> &blocked = {}) {
+    string nodes_csv = "id,name,lat,lon\n", edges_csv = "u,v,distance_m,freeflow_time_s,road_quality,safety_index,edge_id,oneway\n";
+    for(int i=0;i<n;++i) nodes_csv += to_string(i) + ",\"n" + to_string(i) + "\"," + to_string(12.9 + i*0.001) + ",77.5\n";
+    json upd = json::object();
+    for(size_t i=0;i<es.size();++i){
+        char line[160];
+        snprintf(line, sizeof line, "%d,%d,%.2f,%.2f,%.2f,%.2f,%zu,%d\n", es[i].u, es[i].v, es[i].dist, es[i].t, es[i].rq, es[i].si, i, (int)es[i].oneway);
+        edges_csv += line;
+        upd[to_string(i)] = {{"traffic_multiplier", 1.0}, {"rain_mm_hr", 0.0}, {"road_quality_adjust", 0.0},
+                             {"blocked", find(blocked.begin(), blocked.end(), (int)i) != blocked.end()}};
+    }
+    reset_graph();
+    load_nodes(check_file("nodes.csv", nodes_csv));
+    load_edges(check_file("edges.csv", edges_csv));
+    load_updates(check_file("updates.json", upd.dump()));
+}
+
+// a malformed K on one line gets an error result and the rest of the batch still runs
+static void check_batch_bad_k() {
+    load_check_graph(3, {{0,1,100,10,7,7,false}, {1,2,100,10,7,7,false}});
+    string req = check_file("req.ndjson", "{\"start\":0,\"dest\":2,\"K\":\"abc\",\"id\":\"a\"}\n"
+                                          "{\"start\":0,\"dest\":2,\"K\":1,\"id\":\"b\"}\n");
+    string csv = check_file("req.csv", "start,dest,K,id\n0,2,x1,c\n0,2,0,d\n0,2,1,e\n");
+    string out = check_dir + "/res.ndjson";
+    vector<json> res;
+    for(auto &in : {req, csv}){
+        if(run_batch(in, out, false, 1) != 0) { res.clear(); break; }
+        ifstream f(out); string line;
+        while(getline(f, line)) res.push_back(json::parse(line));
+    }
+    bool ok = res.size() == 5;
+    for(size_t i=0; ok && i<res.size(); ++i){
+        bool bad = res[i]["id"] != "b" && res[i]["id"] != "e";
+        ok = bad ? res[i].contains("error") && !res[i].contains("routes") : !res[i].contains("error") && res[i]["routes"].size() == 1;
+    }
+    check("batch: malformed K is a per-line error", ok);
+}
+
+// --simplify keeps parallel edges: which one is usable depends on the updates,
+// both the ones loaded and the ones applied later through refresh_costs
+static void check_simplify_parallel_blocked() {
+    // 0 =(short, long)= 1 - 2, the short 0-1 blocked from the start or after compiling
+    vector<GenEdge> es = {{0,1,100,10,7,7,false}, {0,1,200,20,7,7,false}, {1,2,100,10,7,7,false}};
+    bool ok = true;
+    for(int late=0; late<2; ++late){
+        double got[2];
+        for(int simplify=0; simplify<2; ++simplify){
+            load_check_graph(3, es, late ? vector<int>{} : vector<int>{0});
+            prepare_graph({0, 2}, simplify);
+            if(late) {
+                updates_by_edge[0]["blocked"] = true;
+                vector<int> all(sedges.size());
+                iota(all.begin(), all.end(), 0);
+                refresh_costs(all);
+            }
+            auto p = dijkstra_path(0, 2);
+            got[simplify] = p.empty() ? -1 : route_distance(p);
+        }
+        ok = ok && got[0] == 300 && got[1] == 300;
+    }
+    check("simplify: blocked parallel edge", ok);
+}
+
+// --simplify must not lose chain nodes that are reachable up to a blocked member
+static void check_isochrone_blocked_chain() {
+    // ring 0-1-2-3-4-5-0 with spurs at 0 and 3, so it folds into two chains; 1-2 is blocked
+    vector<GenEdge> es;
+    for(int i=0;i<6;++i) es.push_back({i, (i+1)%6, 100, 10, 7, 7, false});
+    es.push_back({0, 6, 100, 10, 7, 7, false});
+    es.push_back({3, 7, 100, 10, 7, 7, false});
+    for(double budget : {35.0, 1e9}){
+        map<int,double> got[2];
+        for(int simplify=0; simplify<2; ++simplify){
+            load_check_graph(8, es, {1});
+            prepare_graph({0}, simplify);
+            for(auto &pr : isochrone(local_workspace(), 0, budget, true).reached) got[simplify][pr.first] = pr.second;
+        }
+        bool ok = got[0].size() == got[1].size();
+        for(auto &pr : got[0]) ok = ok && got[1].count(pr.first) && fabs(got[1][pr.first] - pr.second) < 1e-6;
+        check("isochrone: partly blocked chain, budget " + to_string((int)min(budget, 1e6)), ok);
+    }
+}
+
+// a subscription rerouted onto a parallel arc between the same two nodes has to
+// move in the route index, or later changes to the new arc go unnoticed
+static void check_subscription_parallel_arc() {
+    load_check_graph(2, {{0,1,100,10,7,7,false}, {0,1,150,10,7,7,false}});
+    auto upd = [](double a, double b){
+        json j;
+        for(int i=0;i<2;++i) j[to_string(i)] = {{"traffic_multiplier", i ? b : a}, {"rain_mm_hr", 0.0}, {"road_quality_adjust", 0.0}, {"blocked", false}};
+        return j.dump();
+    };
+    // 1: the short arc gets slow, move to the long one; 2: the long one gets slower, move back
+    vector<string> files = {check_file("s1.json", upd(2, 1)), check_file("s2.json", upd(2, 3))};
+    string req = check_file("sub.csv", "start,dest,id\n0,1,v\n"), out = check_dir + "/res.ndjson";
+    vector<string> events;
+    if(run_subscriptions(req, out, files, 5, false) == 0) {
+        ifstream f(out); string line;
+        while(getline(f, line)) { json j = json::parse(line); events.push_back(j.value("update", "") + ":" + j["event"].get<string>()); }
+    }
+    check("subscriptions: reroute onto a parallel arc", events == vector<string>{":subscribed", files[0] + ":rerouted", files[1] + ":rerouted"});
+}
+
+// --watch: moving onto the other of two parallel edges keeps the nodes but is a route change
+static void check_watch_parallel_arc() {
+    load_check_graph(3, {{0,1,100,10,7,7,false}, {0,1,150,10,7,7,false}, {1,2,100,10,7,7,false}});
+    json upd = json::object();
+    for(int i=0;i<3;++i) upd[to_string(i)] = {{"traffic_multiplier", i ? 1.0 : 3.0}, {"rain_mm_hr", 0.0}, {"road_quality_adjust", 0.0}, {"blocked", false}};
+    string file = check_file("w1.json", upd.dump());
+    stringstream out;
+    streambuf *old = cout.rdbuf(out.rdbuf());
+    int rc = run_watch("0", "2", {file}, false);
+    cout.rdbuf(old);
+    check("watch: switch between parallel edges", rc == 0 && out.str().find("ROUTE CHANGED") != string::npos);
+}
+
+// the same jittered lattice gen_grid makes for the timing runs, small and seeded
+static int load_check_grid(long long N, uint64_t seed, const vector<int> &blocked = {}) {
+    mt19937_64 rng(seed);
+    vector<GenNode> ns;
+    vector<GenEdge> es;
+    gen_grid(N, rng, ns, es);
+    load_check_graph(ns.size(), es, blocked);
+    return ns.size();
+}
+
+static double route_cost(const vector<int> &p) {
+    double c = 0;
+    for(int a : route_arcs(p)) c += sedge_cost[a];
+    return c;
+}
+
+// --simplify folds chains into one search edge each; every pair of endpoints
+// must still get the same route cost, blocked members and parallel edges included
+static void check_simplify_equivalent() {
+    // 0-1-2-3 and 4-5-6 are chains, 3 =(two edges)= 4, 6-0 closes the ring, 2-7-8 hangs off
+    vector<GenEdge> es = {{0,1,100,10,6,7,false}, {1,2,120,12,8,5,false}, {2,3,90,9,5,9,false},
+                          {3,4,100,10,7,7,false}, {3,4,130,8,9,8,false}, {4,5,110,11,6,6,false},
+                          {5,6,100,10,7,4,false}, {6,0,400,40,7,7,false}, {2,7,80,8,7,7,false}, {7,8,80,8,7,7,false}};
+    bool ok = true;
+    for(auto &blocked : {vector<int>{}, vector<int>{3}, vector<int>{3, 5}, vector<int>{4, 9}})
+        for(int s=0; s<9; ++s) for(int t=0; t<9; ++t){
+            double got[2];
+            for(int simplify=0; simplify<2; ++simplify){
+                load_check_graph(9, es, blocked);
+                prepare_graph({s, t}, simplify);
+                auto p = dijkstra_path(s, t);
+                got[simplify] = p.empty() ? -1 : route_cost(p);
+            }
+            ok = ok && fabs(got[0] - got[1]) < 1e-6;
+        }
+    check("simplify: same costs as the full graph", ok);
+}
+
+// --directed: a oneway edge is only usable from u to v
+static void check_directed_oneway() {
+    vector<GenEdge> es = {{0,1,100,10,7,7,true}, {0,2,150,15,7,7,false}, {2,1,150,15,7,7,false}};
+    vector<int> got[2][2];
+    for(int d=0; d<2; ++d){
+        directed = d;
+        load_check_graph(3, es);
+        prepare_graph({0, 1}, false);
+        got[d][0] = dijkstra_path(0, 1);
+        got[d][1] = dijkstra_path(1, 0);
+    }
+    directed = false;
+    check("directed: oneway edge against its direction",
+          got[0][0] == vector<int>{0, 1} && got[0][1] == vector<int>{1, 0} && got[1][0] == vector<int>{0, 1} && got[1][1] == vector<int>{1, 2, 0});
+}
+
+// nodes in different components are rejected without a search, and a bridge
+// unblocked through refresh_costs joins them again
+static void check_components_reject() {
+    // triangles 0-1-2 and 3-4-5, the bridge 2-3 blocked
+    load_check_graph(6, {{0,1,100,10,7,7,false}, {1,2,100,10,7,7,false}, {2,0,100,10,7,7,false}, {3,4,100,10,7,7,false},
+                         {4,5,100,10,7,7,false}, {5,3,100,10,7,7,false}, {2,3,100,10,7,7,false}}, {6});
+    prepare_graph({0, 4}, false);
+    bool ok = comp_size.size() == 2 && !maybe_reachable(0, 4) && dijkstra_path(0, 4).empty() && maybe_reachable(0, 2) && !dijkstra_path(0, 2).empty();
+    updates_by_edge[6]["blocked"] = false;
+    refresh_costs({6});
+    ok = ok && comp_size.size() == 1 && maybe_reachable(0, 4) && dijkstra_path(0, 4) == vector<int>{0, 2, 3, 4};
+    check("components: reject across a blocked bridge", ok);
+}
+
+// --matrix buckets: the contraction hierarchy answers every cell like one
+// search per source does
+static void check_matrix_buckets() {
+    int n = load_check_grid(36, 11, {3, 17, 18});
+    prepare_graph({}, false);
+    build_ch();
+    vector<int> all(n);
+    iota(all.begin(), all.end(), 0);
+    vector<double> m(n * n, numeric_limits<double>::infinity()), ref(n * n, numeric_limits<double>::infinity());
+    many_to_many_buckets(all, all, m, nullptr);
+    MatrixTargets mt = matrix_targets(all);
+    for(int s=0; s<n; ++s) one_to_many(local_workspace(), s, mt, &ref[s*n]);
+    bool ok = true;
+    for(int i=0; i<n*n; ++i) ok = ok && (isinf(ref[i]) ? isinf(m[i]) : fabs(m[i] - ref[i]) < 1e-6);
+    check("matrix: buckets match per-source search", ok);
+}
+
+// --one-to-all phast: the sweep gives the distances a full Dijkstra does
+static void check_phast() {
+    int n = load_check_grid(36, 12, {0, 1, 20});
+    prepare_graph({}, false);
+    build_ch();
+    bool ok = true;
+    for(int s : {2, 17, n-1}){
+        vector<double> dist;
+        phast(local_workspace(), s, dist);
+        ShortestPathTree t;
+        build_spt(t, s);
+        for(int v=0; v<n; ++v) ok = ok && (t.dist[v] >= SearchWorkspace::INF ? isinf(dist[v]) : fabs(dist[v] - t.dist[v]) < 1e-6);
+    }
+    check("phast: distances match Dijkstra", ok);
+}
+
+// --pareto with eps 0 returns exactly the non-dominated (distance, time,
+// safety) set; the reference keeps every label and has no bounds
+static void check_pareto() {
+    int n = load_check_grid(16, 13, {5});
+    prepare_graph({0, n-1}, false);
+    const vector<double> *cols[PARETO_DIMS] = {&cost_terms.dist, &cost_terms.time, &cost_terms.safety};
+    vector<vector<array<double,PARETO_DIMS>>> bag(n);
+    deque<pair<int, array<double,PARETO_DIMS>>> q;
+    bag[0].push_back({0, 0, 0}); q.push_back({0, {0, 0, 0}});
+    while(!q.empty()){
+        auto [u, c] = q.front(); q.pop_front();
+        if(u == n-1 || find(bag[u].begin(), bag[u].end(), c) == bag[u].end()) continue;
+        for(auto &a : adj[u]){
+            if(cost_terms.blocked[a.ei] != 0.0) continue;
+            array<double,PARETO_DIMS> nc;
+            for(int k=0;k<PARETO_DIMS;++k) nc[k] = c[k] + (*cols[k])[a.ei];
+            auto &b = bag[a.to];
+            if(any_of(b.begin(), b.end(), [&](auto &x){ return pareto_covers(x.data(), nc.data(), 0); })) continue;
+            b.erase(remove_if(b.begin(), b.end(), [&](auto &x){ return pareto_covers(nc.data(), x.data(), 0); }), b.end());
+            b.push_back(nc); q.push_back({a.to, nc});
+        }
+    }
+    auto ref = bag[n-1];
+    sort(ref.begin(), ref.end());
+    auto got = pareto_routes(0, n-1, 0.0);
+    bool ok = got.size() == ref.size() && got.size() > 1;
+    for(size_t i=0; ok && i<got.size(); ++i)
+        for(int k=0;k<PARETO_DIMS;++k) ok = ok && fabs(got[i].c[k] - ref[i][k]) < 1e-6;
+    check("pareto: eps 0 gives the full front", ok);
+}
+
+// --max-slower: the safest route within the time limit, against a
+// label-correcting search that keeps every (safety, time) pair under it
+static void check_max_slower() {
+    int n = load_check_grid(25, 14, {7});
+    prepare_graph({0, n-1}, false);
+    auto ref = [&](double limit){
+        vector<vector<pair<double,double>>> bag(n);
+        deque<pair<int, pair<double,double>>> q;
+        bag[0].push_back({0, 0}); q.push_back({0, {0, 0}});
+        while(!q.empty()){
+            auto [u, c] = q.front(); q.pop_front();
+            if(u == n-1 || find(bag[u].begin(), bag[u].end(), c) == bag[u].end()) continue;
+            for(auto &a : adj[u]){
+                if(cost_terms.blocked[a.ei] != 0.0) continue;
+                pair<double,double> nc{c.first + cost_terms.safety[a.ei], c.second + cost_terms.time[a.ei]};
+                if(nc.second > limit + 1e-9) continue;
+                auto &b = bag[a.to];
+                if(any_of(b.begin(), b.end(), [&](auto &x){ return x.first <= nc.first && x.second <= nc.second; })) continue;
+                b.erase(remove_if(b.begin(), b.end(), [&](auto &x){ return nc.first <= x.first && nc.second <= x.second; }), b.end());
+                b.push_back(nc); q.push_back({a.to, nc});
+            }
+        }
+        double best = SearchWorkspace::INF;
+        for(auto &x : bag[n-1]) best = min(best, x.first);
+        return best;
+    };
+    bool ok = true;
+    for(double slower : {0.0, 0.05, 0.15, 1.0}){
+        ConstrainedRoute r = safest_within(local_workspace(), 0, n-1, slower);
+        ok = ok && !r.route.empty() && r.time <= r.limit + 1e-6 && fabs(r.safety - ref(r.limit)) < 1e-6;
+    }
+    check("max-slower: safest route within the limit", ok);
+}
+
+// --depart: A* on the chord bound arrives when plain Dijkstra does, and
+// leaving later never arrives earlier (FIFO profiles)
+static void check_td_route() {
+    int n = load_check_grid(25, 15);
+    json prof = json::object();
+    for(size_t i=0; i<edges.size(); ++i)
+        prof[to_string(i)] = i % 3 ? json::array({json::array({"07:00", 1.0}), json::array({"08:30", 2.5 + i % 4}), json::array({"10:00", 1.0})})
+                                   : json::array({json::array({"17:00", 1.0}), json::array({"18:00", 4.0}), json::array({"18:10", 1.0})});
+    bool ok = load_td_profiles(check_file("td.json", prof.dump()));
+    prepare_graph({0, n-1}, false);
+    prepare_td();
+    double vmax = td_max_speed(), last = -1;
+    ok = ok && vmax > 0;
+    for(double depart = 6 * 3600.0; ok && depart < 20 * 3600.0; depart += 600){
+        double a_star, a_plain;
+        ok = !td_route(local_workspace(), 0, n-1, depart, vmax, &a_star).empty() && !td_route(local_workspace(), 0, n-1, depart, 0.0, &a_plain).empty()
+             && fabs(a_star - a_plain) < 1e-6 && a_star >= last - 1e-6;
+        last = a_star;
+    }
+    td_profiles = TrafficProfiles();
+    check("td: A* matches Dijkstra, FIFO arrivals", ok);
+}
+
+// --history: every slot decodes to the multipliers that went in (values on
+// the store's 1/256 grid), through the store and through the loaded edges
+static void check_history_round_trip() {
+    load_check_grid(36, 16);
+    const uint32_t slots = 40;
+    vector<vector<float>> in;
+    string path = check_dir + "/h.sph";
+    bool ok = write_history(path, slots, [&](uint32_t s, vector<float> &mul){
+        for(size_t e=0; e<mul.size(); ++e) mul[e] = (e % 5 ? 256 + (int)((e * 37 + s * (e % 7)) % 700) : (s * 131 + e) % 65536) * HISTORY_STEP;
+        in.push_back(mul);
+        return true;
+    }, nullptr);
+    HistoryStore hs;
+    ok = ok && hs.open(path);
+    vector<float> mul;
+    for(uint32_t s=0; ok && s<slots; ++s) ok = hs.slice(s, mul) && mul == in[s];
+    ok = ok && load_history_slice(path, 33);
+    for(size_t e=0; ok && e<edges.size(); ++e) ok = edge_traffic(e) == in[33][e];
+    traffic_slice.clear();
+    check("history: slots round-trip exactly", ok);
+}
+
+// --watch: the repaired tree has the distances a fresh search finds, through
+// dearer, cheaper, blocked and unblocked edges
+static void check_watch_repair() {
+    int n = load_check_grid(49, 17);
+    prepare_graph({0}, false);
+    ShortestPathTree t;
+    build_spt(t, 0);
+    mt19937_64 rng(17);
+    bool ok = true;
+    for(int round=0; round<30; ++round){
+        auto before = updates_by_edge;
+        for(int k=0; k<4; ++k){
+            json &u = updates_by_edge[rng() % edges.size()];
+            if(rng() % 4 == 0) u["blocked"] = !u["blocked"].get<bool>();
+            else u["traffic_multiplier"] = 1.0 + (rng() % 300) / 100.0;
+        }
+        vector<int> ch = changed_sedges(before, updates_by_edge);
+        vector<double> old_cost(ch.size());
+        for(size_t k=0; k<ch.size(); ++k) old_cost[k] = sedge_cost[ch[k]] >= 1e6 ? SearchWorkspace::INF : sedge_cost[ch[k]];
+        refresh_costs(ch);
+        repair_spt(t, ch, old_cost);
+        ShortestPathTree fresh;
+        build_spt(fresh, 0);
+        for(int v=0; v<n; ++v) ok = ok && (fresh.dist[v] >= SearchWorkspace::INF ? t.dist[v] >= SearchWorkspace::INF : fabs(t.dist[v] - fresh.dist[v]) < 1e-6);
+    }
+    check("watch: repaired tree matches a fresh search", ok);
+}
+
+static int run_checks() {
+    char tmpl[] = "/tmp/safepath_check_XXXXXX";
+    if(!mkdtemp(tmpl)) { cerr << "cannot create a scratch directory\n"; return 1; }
+    check_dir = tmpl;
+    char here[4096];
+    if(!getcwd(here, sizeof here) || chdir(tmpl) != 0) { cerr << "cannot enter " << tmpl << "\n"; return 1; } // modes write path.json to the cwd
+    streambuf *out = cout.rdbuf(nullptr), *err = cerr.rdbuf(nullptr); // the modes' own reports
+    check_batch_bad_k();
+    check_simplify_parallel_blocked();
+    check_isochrone_blocked_chain();
+    check_subscription_parallel_arc();
+    check_watch_parallel_arc();
+    check_simplify_equivalent();
+    check_directed_oneway();
+    check_components_reject();
+    check_matrix_buckets();
+    check_phast();
+    check_pareto();
+    check_max_slower();
+    check_td_route();
+    check_history_round_trip();
+    check_watch_repair();
+    cout.rdbuf(out); cerr.rdbuf(err);
+    for(auto *f : {"nodes.csv", "edges.csv", "updates.json", "req.ndjson", "req.csv", "res.ndjson", "s1.json", "s2.json", "sub.csv", "w1.json", "td.json", "h.sph", "path.json"}) remove((check_dir + "/" + f).c_str());
+    if(chdir(here) != 0) cerr << "cannot return to " << here << "\n";
+    rmdir(check_dir.c_str());
+    return check_failures ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    vector<string> args;
+    unique_ptr<ThreadPool> pool;
+    for(int i=1;i<argc;++i){
+        if(string(argv[i]) == "--threads" && i+1 < argc) { int t = stoi(argv[++i]); if(t > 1) { pool.reset(new ThreadPool(t)); engine_pool = pool.get(); } }
+        else if(string(argv[i]) == "--phast") bench_phast = true;
+        else if(string(argv[i]) == "--history") bench_history = true;
+        else args.push_back(argv[i]);
+    }
+    auto usage = []{
+        cerr << "Usage: safepath_bench gen <grid|geo|road> N outdir [seed]\n"
+                "       safepath_bench run <grid|geo|road> N [queries] [K] [seed]\n"
+                "       safepath_bench dir <datadir> [queries] [K] [seed]\n"
+                "       safepath_bench check\n";
+        return 1;
+    };
+    if(args.empty()) return usage();
+    if(args[0] == "gen" && args.size() >= 4)
+        return generate(args[1], parse_count(args[2]), args[3], args.size() > 4 ? stoull(args[4]) : 1) ? 0 : 1;
+    if(args[0] == "run" && args.size() >= 3) {
+        string dir = "bench_" + args[1] + "_" + args[2];
+        uint64_t seed = args.size() > 5 ? stoull(args[5]) : 1;
+        if(!generate(args[1], parse_count(args[2]), dir, seed)) return 1;
+        return run_dir(dir, args.size() > 3 ? stoi(args[3]) : 200, args.size() > 4 ? stoi(args[4]) : 3, seed);
+    }
+    if(args[0] == "check") return run_checks();
+    if(args[0] == "dir" && args.size() >= 2)
+        return run_dir(args[1], args.size() > 2 ? stoi(args[2]) : 200, args.size() > 3 ? stoi(args[3]) : 3, args.size() > 4 ? stoull(args[4]) : 1);
+    return usage();
+}
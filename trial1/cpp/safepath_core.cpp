@@ -1,21 +1,131 @@
 // safepath_core.cpp
-// Compile: g++ -std=c++17 safepath_core.cpp -O2 -o safepath_core
-// Usage: ./safepath_core data/nodes.csv data/edges.csv data/updates.json start_node dest_node K
+// Compile: g++ -std=c++17 safepath_core.cpp -O2 -pthread -I.. -o safepath_core
+// Usage: ./safepath_core data/nodes.csv data/edges.csv data/updates.json start_node dest_node K [--directed]
 #include <bits/stdc++.h>
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include <nlohmann/json.hpp> // need json single header; instructions below
 using json = nlohmann::json;
 using namespace std;
 
-struct Node { int id; string name; double lat, lon; };
-struct Edge { int u,v; double distance_m; double freeflow_time_s; double road_quality; double safety_index; int edge_id; };
+struct Node { int id; uint32_t name; double lat, lon; }; // name = id into names arena
+
+// all node names live in one contiguous buffer; repeated names (street names,
+// segN step nodes) are stored once and nodes only keep a 4-byte name id
+struct NameArena {
+    string buf;                  // concatenated unique names
+    vector<uint32_t> off, len;   // per name id
+    vector<uint32_t> slots;      // open addressing table: name id + 1, 0 = empty
+    vector<int> first_node;      // name id -> first node carrying that name
+
+    string_view get(uint32_t id) const { return string_view(buf.data() + off[id], len[id]); }
+    size_t size() const { return off.size(); }
+
+    uint32_t intern(string_view s) {
+        if(slots.empty() || (off.size()+1)*2 > slots.size()) grow();
+        size_t mask = slots.size()-1;
+        for(size_t h = hash<string_view>()(s) & mask; ; h = (h+1) & mask){
+            if(slots[h] == 0){
+                uint32_t id = (uint32_t)off.size();
+                off.push_back((uint32_t)buf.size()); len.push_back((uint32_t)s.size());
+                buf.append(s.data(), s.size());
+                first_node.push_back(-1);
+                slots[h] = id+1;
+                return id;
+            }
+            if(get(slots[h]-1) == s) return slots[h]-1;
+        }
+    }
+    // -1 if the name was never interned
+    int find(string_view s) const {
+        if(slots.empty()) return -1;
+        size_t mask = slots.size()-1;
+        for(size_t h = hash<string_view>()(s) & mask; slots[h] != 0; h = (h+1) & mask)
+            if(get(slots[h]-1) == s) return (int)slots[h]-1;
+        return -1;
+    }
+    void grow() {
+        vector<uint32_t> ns(max<size_t>(64, slots.size()*2), 0);
+        size_t mask = ns.size()-1;
+        for(uint32_t id=0; id<off.size(); ++id){
+            size_t h = hash<string_view>()(get(id)) & mask;
+            while(ns[h] != 0) h = (h+1) & mask;
+            ns[h] = id+1;
+        }
+        slots.swap(ns);
+    }
+};
+struct Edge { int u,v; double distance_m; double freeflow_time_s; double road_quality; double safety_index; int edge_id; bool oneway; };
+// search edge: a run of original edges (a contracted degree-2 chain) from u to v.
+// Without --simplify every edge is its own search edge.
+struct SEdge { int u,v; bool oneway; double distance_m, freeflow_time_s; };
 
 vector<Node> nodes;
-vector<vector<pair<int,int>>> adj; // adj[u] -> vector of (v, edge_index)
+NameArena names;
+// compressed sparse row adjacency: arcs of u are arcs[off[u] .. off[u+1])
+struct Arc { int to; int ei; }; // ei = search edge index
+struct ArcRange {
+    const Arc *b, *e;
+    const Arc* begin() const { return b; }
+    const Arc* end() const { return e; }
+    size_t size() const { return e - b; }
+};
+struct CSR {
+    vector<int> off{0};
+    vector<Arc> arcs;
+    size_t size() const { return off.size()-1; }
+    ArcRange operator[](int u) const { return {arcs.data()+off[u], arcs.data()+off[u+1]}; }
+};
+CSR adj;  // forward: adj[u] -> arcs (v, sedge_index)
+CSR radj; // reverse: radj[v] -> arcs (u, sedge_index) for every forward arc u->v (directed mode only)
+
+// directed mode: edges only run u->v unless their oneway flag is 0.
+// Legacy mode treats every edge as two-way, so adj is its own reverse.
+bool directed = false;
+const CSR& rev_adj() { return directed ? radj : adj; }
 vector<Edge> edges;
+vector<SEdge> sedges;
+vector<int> sedge_off{0}, sedge_members; // edges of sedge i, in u->v order: sedge_members[sedge_off[i] .. sedge_off[i+1])
+vector<double> sedge_cost;               // compiled composite cost per search edge (see compile_costs)
+vector<double> sedge_time;               // compiled travel time (s) per search edge: freeflow * traffic multiplier
+vector<float> traffic_slice;             // per edge: multiplier from a --history slot, < 0 (or empty) = updates.json
+// edge_cost's terms per search edge (struct of arrays, summed over chain members).
+// The composite cost is linear in them, so a weight change is one pass of the
+// cost kernel over these columns instead of re-reading every update.
+struct CostTerms { vector<double> dist, traffic, rain, road, safety, time, blocked; }; // blocked: 0 or 1
+CostTerms cost_terms;
+vector<char> contracted;                 // node folded into a chain by simplify_graph, not searchable
+vector<char> sedge_blocked;              // blocked set the components below were computed for
+
+// connected components over unblocked search edges, refreshed whenever the blocked set changes.
+// Weak components answer "unreachable" in O(1); strong ones are diagnostics in directed mode.
+vector<int> comp_id, comp_size; // weak
+vector<int> scc_id, scc_size;   // strong (directed mode only; equals weak otherwise)
+
+// contraction hierarchy over sedge_cost (see build_ch), used by the bucket matrix mode.
+// up[v]: arcs v->w with rank[w] > rank[v]; down[v]: arcs w->v with rank[w] > rank[v], stored as (w, cost).
+struct CHArc { int to; double w; };
+struct ContractionHierarchy {
+    vector<int> rank;
+    vector<int> up_off, down_off;
+    vector<CHArc> up, down;
+    // PHAST layout: position i holds the node of rank n-1-i, sweep_in[i] its down
+    // arcs with the tail as a position (always < i), so one-to-all is a linear pass
+    vector<int> sweep_node, sweep_off;
+    vector<CHArc> sweep_in;
+    size_t shortcuts = 0;
+    bool built() const { return !rank.empty(); }
+};
+ContractionHierarchy ch;
 
 unordered_map<int, json> updates_by_edge; // edge_id -> update object
+unordered_map<string, vector<int>> tagged_nodes; // lowercased tag -> nodes (optional 5th nodes.csv column, "hospital;trauma")
 
 // weights (configurable)
 double W_TIME = 1.0;
@@ -25,34 +135,326 @@ double W_ROAD_QUAL = 200.0;
 double W_SAFETY = 180.0;
 double W_BLOCK = 1e7;
 
+// per-query instrumentation (--stats). Searches count into locals and only fold
+// them into search_stats when collect_stats is set, so the hot loops stay as is.
+struct SearchStats { uint64_t searches=0, settled=0, relaxed=0, pushes=0, pops=0, stale_pops=0; };
+struct PhaseTimes { double load_ms=0, compile_ms=0, search_ms=0, kpaths_ms=0, output_ms=0, matrix_ms=0; };
+bool collect_stats = false;
+SearchStats search_stats;
+PhaseTimes phase_times;
+using stat_clock = chrono::steady_clock;
+// adds the scope's wall time to acc when stats are enabled
+mutex stats_mu; // searches may run on several threads
+struct PhaseTimer {
+    double *acc; stat_clock::time_point t0;
+    explicit PhaseTimer(double &a) : acc(collect_stats ? &a : nullptr) { if(acc) t0 = stat_clock::now(); }
+    ~PhaseTimer() {
+        if(!acc) return;
+        double ms = chrono::duration<double, milli>(stat_clock::now() - t0).count();
+        lock_guard<mutex> lk(stats_mu);
+        *acc += ms;
+    }
+};
+void add_search_stats(uint64_t settled, uint64_t relaxed, uint64_t pushes, uint64_t pops) {
+    lock_guard<mutex> lk(stats_mu);
+    search_stats.searches++; search_stats.settled += settled; search_stats.relaxed += relaxed;
+    search_stats.pushes += pushes; search_stats.pops += pops; search_stats.stale_pops += pops - settled;
+}
+
+json stats_json() {
+    json st;
+    st["searches"] = search_stats.searches;
+    st["settled_nodes"] = search_stats.settled;
+    st["relaxed_edges"] = search_stats.relaxed;
+    st["heap_pushes"] = search_stats.pushes;
+    st["heap_pops"] = search_stats.pops;
+    st["stale_pops"] = search_stats.stale_pops;
+    st["load_ms"] = phase_times.load_ms;
+    st["cost_compile_ms"] = phase_times.compile_ms;
+    st["search_ms"] = phase_times.search_ms;
+    st["kpaths_ms"] = phase_times.kpaths_ms;
+    st["output_ms"] = phase_times.output_ms;
+    st["matrix_ms"] = phase_times.matrix_ms;
+    return st;
+}
+
+// Chrome trace export (--trace out.json): complete ("X") events around engine
+// phases, viewable in chrome://tracing or ui.perfetto.dev. A disabled scope is
+// one branch on construction and one on destruction.
+struct TraceEvent { const char *name; string args; double ts_us, dur_us; uint32_t tid; };
+bool tracing = false;
+vector<TraceEvent> trace_events;
+mutex trace_mu;
+const stat_clock::time_point trace_t0 = stat_clock::now();
+uint32_t trace_tid() {
+    static atomic<uint32_t> next{0};
+    thread_local uint32_t id = next++;
+    return id;
+}
+struct TraceScope {
+    const char *name; string args; stat_clock::time_point t0; bool on;
+    explicit TraceScope(const char *n) : name(n), on(tracing) { if(on) t0 = stat_clock::now(); }
+    ~TraceScope() {
+        if(!on) return;
+        auto t1 = stat_clock::now();
+        TraceEvent ev{name, move(args), chrono::duration<double, micro>(t0 - trace_t0).count(),
+                      chrono::duration<double, micro>(t1 - t0).count(), trace_tid()};
+        lock_guard<mutex> lk(trace_mu);
+        trace_events.push_back(move(ev));
+    }
+};
+
+bool write_trace(const string &outfn) {
+    json j;
+    j["displayTimeUnit"] = "ms";
+    j["traceEvents"] = json::array();
+    lock_guard<mutex> lk(trace_mu);
+    for(auto &ev: trace_events){
+        json e;
+        e["name"] = ev.name; e["cat"] = "safepath"; e["ph"] = "X"; e["pid"] = 1; e["tid"] = ev.tid;
+        e["ts"] = ev.ts_us; e["dur"] = ev.dur_us;
+        if(!ev.args.empty()) e["args"] = json::parse(ev.args, nullptr, false);
+        j["traceEvents"].push_back(e);
+    }
+    ofstream fo(outfn);
+    if(!fo) return false;
+    fo << j;
+    return true;
+}
+
+void print_stats(ostream &os) {
+    os << "stats: searches=" << search_stats.searches << " settled=" << search_stats.settled
+       << " relaxed=" << search_stats.relaxed << " pushes=" << search_stats.pushes << " pops=" << search_stats.pops
+       << " stale_pops=" << search_stats.stale_pops << "\n";
+    os << "stats: load=" << phase_times.load_ms << "ms compile=" << phase_times.compile_ms << "ms search="
+       << phase_times.search_ms << "ms kpaths=" << phase_times.kpaths_ms << "ms output=" << phase_times.output_ms << "ms matrix=" << phase_times.matrix_ms << "ms\n";
+}
+
+// run f(begin, end) over [0,n) split in contiguous chunks, one per thread
+template<class F> void parallel_chunks(size_t n, F f, size_t min_chunk = 1<<16) {
+    size_t T = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), n / min_chunk));
+    if(T <= 1) { f((size_t)0, n); return; }
+    vector<thread> ts;
+    for(size_t t=0;t<T;++t) ts.emplace_back(f, n*t/T, n*(t+1)/T);
+    for(auto &t: ts) t.join();
+}
+
+// work-stealing pool: every worker owns a deque, pops its own newest task and
+// steals the oldest task of another worker when idle
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t n) {
+        n = max<size_t>(1, n);
+        for(size_t i=0;i<n;++i) qs.emplace_back(new Queue);
+        for(size_t i=0;i<n;++i) workers.emplace_back([this,i]{ run(i); });
+    }
+    ~ThreadPool() {
+        { lock_guard<mutex> lk(mu); stop = true; }
+        cv.notify_all();
+        for(auto &t: workers) t.join();
+    }
+    size_t size() const { return workers.size(); }
+    void submit(function<void()> f) {
+        size_t i = rr++ % qs.size();
+        { lock_guard<mutex> lk(qs[i]->mu); qs[i]->q.push_back(move(f)); }
+        { lock_guard<mutex> lk(mu); pending++; }
+        cv.notify_one();
+    }
+private:
+    struct Queue { mutex mu; deque<function<void()>> q; };
+    vector<unique_ptr<Queue>> qs;
+    vector<thread> workers;
+    mutex mu; condition_variable cv;
+    size_t pending = 0; bool stop = false;
+    atomic<size_t> rr{0};
+    bool take(size_t self, function<void()> &f) {
+        for(size_t k=0;k<qs.size();++k){
+            Queue &q = *qs[(self+k) % qs.size()];
+            lock_guard<mutex> lk(q.mu);
+            if(q.q.empty()) continue;
+            if(k == 0) { f = move(q.q.back()); q.q.pop_back(); }
+            else { f = move(q.q.front()); q.q.pop_front(); }
+            return true;
+        }
+        return false;
+    }
+    void run(size_t self) {
+        while(true){
+            {
+                unique_lock<mutex> lk(mu);
+                cv.wait(lk, [&]{ return stop || pending > 0; });
+                if(stop && pending == 0) return;
+                pending--;
+            }
+            function<void()> f;
+            while(!take(self, f)) this_thread::yield(); // the task is in some deque already
+            f();
+        }
+    }
+};
+
+ThreadPool *engine_pool = nullptr; // shared by batch requests and spur searches (null = sequential)
+
+// run f(i) for i in [0,n) on the pool; the calling thread claims indices too,
+// so this is safe to call from inside a pool task
+template<class F> void pool_for(ThreadPool *pool, size_t n, F f) {
+    if(!pool || pool->size() <= 1 || n <= 1) { for(size_t i=0;i<n;++i) f(i); return; }
+    struct Shared { atomic<size_t> next{0}, done{0}; mutex mu; condition_variable cv; };
+    auto sh = make_shared<Shared>();
+    auto body = [sh, n, &f]{
+        size_t i, cnt = 0;
+        while((i = sh->next.fetch_add(1)) < n) { f(i); cnt++; }
+        if(cnt && sh->done.fetch_add(cnt) + cnt == n) { lock_guard<mutex> lk(sh->mu); sh->cv.notify_all(); }
+    };
+    size_t helpers = min(pool->size(), n-1);
+    for(size_t t=0;t<helpers;++t) pool->submit(body);
+    body();
+    unique_lock<mutex> lk(sh->mu);
+    sh->cv.wait(lk, [&]{ return sh->done.load() == n; });
+}
+
+// parallel CSR builder: count degrees, prefix sum with per-thread block offsets,
+// scatter through per-node cursors, then sort each node's arcs so the result
+// does not depend on thread scheduling. Edges contribute u->v, plus v->u when
+// two-way; rev is only filled when with_rev (otherwise it is cleared).
+void build_csr(const vector<SEdge> &es, int n, bool dir, CSR &fwd, CSR &rev, bool with_rev) {
+    size_t m = es.size();
+    unique_ptr<atomic<int>[]> fdeg(new atomic<int>[n+1]), rdeg(new atomic<int>[n+1]);
+    parallel_chunks(n+1, [&](size_t b, size_t e){ for(size_t i=b;i<e;++i){ fdeg[i].store(0,memory_order_relaxed); rdeg[i].store(0,memory_order_relaxed); } });
+    auto arc_pairs = [&](size_t i, auto emit){
+        emit(es[i].u, es[i].v);
+        if(!dir || !es[i].oneway) emit(es[i].v, es[i].u);
+    };
+    parallel_chunks(m, [&](size_t b, size_t e){
+        for(size_t i=b;i<e;++i) arc_pairs(i, [&](int a, int c){
+            fdeg[a].fetch_add(1,memory_order_relaxed);
+            if(with_rev) rdeg[c].fetch_add(1,memory_order_relaxed);
+        });
+    });
+    auto prefix = [&](atomic<int> *deg, CSR &g){
+        g.off.assign(n+1, 0);
+        size_t T = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), (n+1) / (1<<16)));
+        vector<long long> block_sum(T+1, 0);
+        auto block = [&](size_t t, bool second){
+            size_t b = (n+1)*t/T, e = (n+1)*(t+1)/T;
+            long long acc = second ? block_sum[t] : 0;
+            for(size_t i=b;i<e;++i){
+                int d = deg[i].load(memory_order_relaxed);
+                if(second) { g.off[i] = (int)acc; deg[i].store((int)acc, memory_order_relaxed); }
+                acc += d;
+            }
+            if(!second) block_sum[t+1] = acc;
+        };
+        vector<thread> ts;
+        for(size_t t=1;t<T;++t) ts.emplace_back(block, t, false);
+        block(0, false);
+        for(auto &t: ts) t.join();
+        ts.clear();
+        for(size_t t=1;t<=T;++t) block_sum[t] += block_sum[t-1];
+        for(size_t t=1;t<T;++t) ts.emplace_back(block, t, true);
+        block(0, true);
+        for(auto &t: ts) t.join();
+        // deg[] now holds the write cursor of every node; off[n] is the arc count
+        g.arcs.resize(block_sum[T]);
+    };
+    prefix(fdeg.get(), fwd);
+    if(with_rev) prefix(rdeg.get(), rev);
+    else { rev.off.assign(1, 0); rev.arcs.clear(); rev.arcs.shrink_to_fit(); }
+    parallel_chunks(m, [&](size_t b, size_t e){
+        for(size_t i=b;i<e;++i) arc_pairs(i, [&](int a, int c){
+            fwd.arcs[fdeg[a].fetch_add(1,memory_order_relaxed)] = {c,(int)i};
+            if(with_rev) rev.arcs[rdeg[c].fetch_add(1,memory_order_relaxed)] = {a,(int)i};
+        });
+    });
+    for(CSR *g : {&fwd, &rev}) if(g->size() == (size_t)n)
+        parallel_chunks(n, [&](size_t b, size_t e){
+            for(size_t u=b;u<e;++u)
+                sort(g->arcs.begin()+g->off[u], g->arcs.begin()+g->off[u+1], [](const Arc &x, const Arc &y){ return x.ei != y.ei ? x.ei < y.ei : x.to < y.to; });
+        }, 1<<12);
+}
+
+// rebuild both adjacencies from the search edge array (after load or bulk edits)
+void rebuild_graph() {
+    TraceScope ts("build_csr");
+    int maxn=0;
+    for(auto &n: nodes) maxn = max(maxn, n.id);
+    for(auto &e: edges) maxn = max(maxn, max(e.u, e.v));
+    build_csr(sedges, maxn+1, directed, adj, radj, directed);
+}
+
+// one search edge per original edge
+void reset_search_edges() {
+    sedges.resize(edges.size());
+    sedge_off.resize(edges.size()+1);
+    sedge_members.resize(edges.size());
+    for(size_t i=0;i<edges.size();++i){
+        auto &e = edges[i];
+        sedges[i] = {e.u, e.v, e.oneway, e.distance_m, e.freeflow_time_s};
+        sedge_off[i] = (int)i; sedge_members[i] = (int)i;
+    }
+    sedge_off[edges.size()] = (int)edges.size();
+    contracted.assign(nodes.size(), 0);
+}
+
+string_view node_name(int nid) { return names.get(nodes[nid].name); }
+
+// drop every loaded table so another graph can be loaded into this process
+void reset_graph() {
+    nodes.clear(); names = NameArena();
+    edges.clear(); updates_by_edge.clear(); tagged_nodes.clear();
+    reset_search_edges();
+    adj = CSR(); radj = CSR();
+    sedge_cost.clear(); sedge_time.clear(); sedge_blocked.clear(); cost_terms = CostTerms();
+    comp_id.clear(); comp_size.clear(); scc_id.clear(); scc_size.clear();
+    ch = ContractionHierarchy();
+}
+
+// naive CSV split honouring double quotes; parts are reused across lines.
+// Returns the number of fields on the line.
+size_t split_csv(const string &line, vector<string> &parts) {
+    size_t np=0; bool inq=false;
+    if(parts.empty()) parts.emplace_back();
+    for(auto &p: parts) p.clear();
+    for(char c:line){
+        if(c=='\"') inq=!inq;
+        else if(c==',' && !inq){ if(++np==parts.size()) parts.emplace_back(); }
+        else if(c!='\r') parts[np].push_back(c);
+    }
+    return np+1;
+}
+
 bool load_nodes(const string &path) {
+    TraceScope ts("load_nodes");
     ifstream f(path);
     if(!f) return false;
     string line;
     getline(f,line);
+    vector<string> parts(5);
     while(getline(f,line)){
         if(line.empty()) continue;
-        stringstream ss(line);
-        int id; string name; double lat, lon;
-        // id,name,lat,lon
-        string id_s, name_s, lat_s, lon_s;
-        // naive CSV parse
-        vector<string> parts;
-        bool inq=false; string cur="";
-        for(char c:line){
-            if(c=='\"') inq=!inq;
-            else if(c==',' && !inq){ parts.push_back(cur); cur=""; }
-            else cur.push_back(c);
-        }
-        parts.push_back(cur);
-        if(parts.size()<4) continue;
-        id = stoi(parts[0]); name = parts[1]; lat = stod(parts[2]); lon = stod(parts[3]);
-        nodes.push_back({id,name,lat,lon});
+        // id,name,lat,lon[,tags]
+        size_t nf = split_csv(line, parts);
+        if(nf<4) continue;
+        int id = stoi(parts[0]); double lat = stod(parts[2]), lon = stod(parts[3]);
+        uint32_t nm = names.intern(parts[1]);
+        if(names.first_node[nm] == -1) names.first_node[nm] = id;
+        nodes.push_back({id,nm,lat,lon});
+        if(nf >= 5 && !parts[4].empty()) {
+            stringstream ss(parts[4]);
+            string tag;
+            while(getline(ss, tag, ';')){
+                tag.erase(0, tag.find_first_not_of(' '));
+                tag.erase(tag.find_last_not_of(' ')+1);
+                transform(tag.begin(), tag.end(), tag.begin(), ::tolower);
+                if(!tag.empty()) tagged_nodes[tag].push_back(id);
+            }
+        }
     }
     return true;
 }
 
 bool load_edges(const string &path) {
+    TraceScope ts("load_edges");
     ifstream f(path);
     if(!f) return false;
     string line;
@@ -61,26 +463,20 @@ bool load_edges(const string &path) {
     while(getline(f,line)){
         if(line.empty()) continue;
         stringstream ss(line);
-        int u,v; double dist, t, rq, si; int eid;
+        int u,v; double dist, t, rq, si; int eid, ow=0;
         char comma;
         ss>>u>>comma>>v>>comma>>dist>>comma>>t>>comma>>rq>>comma>>si>>comma>>eid;
-        edges.push_back({u,v,dist,t,rq,si,eid});
+        if(!(ss>>comma>>ow)) ow=0; // optional 8th column: oneway (1 = only u->v)
+        edges.push_back({u,v,dist,t,rq,si,eid,ow!=0});
         idx++;
     }
-    // build adjacency sized by max node id
-    int maxn=0;
-    for(auto &n: nodes) maxn = max(maxn, n.id);
-    adj.assign(maxn+1, {});
-    for(size_t i=0;i<edges.size();++i){
-        auto &e = edges[i];
-        adj[e.u].push_back({e.v, (int)i});
-        // also add reverse if needed (OSRM edges are directed but we will add reverse to allow path)
-        adj[e.v].push_back({e.u, (int)i});
-    }
+    reset_search_edges();
+    rebuild_graph();
     return true;
 }
 
 bool load_updates(const string &path) {
+    TraceScope ts("load_updates");
     ifstream f(path);
     if(!f) return false;
     json j; f>>j;
@@ -94,7 +490,7 @@ bool load_updates(const string &path) {
 
 // compute composite edge cost for an edge index
 double edge_cost(int edge_index) {
-    Edge e = edges[edge_index];
+    const Edge &e = edges[edge_index];
     // base travel time (seconds) -> scale convert to a baseline meters equivalent
     double base_time = e.freeflow_time_s;
     // get update multipliers
@@ -102,13 +498,15 @@ double edge_cost(int edge_index) {
     double rain_mm = 0.0;
     bool blocked=false;
     double road_adj = 0.0;
-    if(updates_by_edge.count(e.edge_id)) {
-        auto &obj = updates_by_edge[e.edge_id];
+    auto it = updates_by_edge.find(e.edge_id);
+    if(it != updates_by_edge.end()) {
+        const json &obj = it->second;
         if(obj.contains("traffic_multiplier")) traffic_mul = (double)obj["traffic_multiplier"];
         if(obj.contains("rain_mm_hr")) rain_mm = (double)obj["rain_mm_hr"];
         if(obj.contains("blocked")) blocked = (bool)obj["blocked"];
         if(obj.contains("road_quality_adjust")) road_adj = (double)obj["road_quality_adjust"];
     }
+    if(!traffic_slice.empty() && traffic_slice[edge_index] >= 0) traffic_mul = traffic_slice[edge_index];
     if(blocked) return W_BLOCK;
     // metrics:
     double traffic_pen = (traffic_mul - 1.0) * e.distance_m; // extra delay ~ multiplier * distance
@@ -122,125 +520,591 @@ double edge_cost(int edge_index) {
     return cost;
 }
 
-// Dijkstra to compute single shortest path using composite edge cost
-struct Pred { double dist; int prev; int prev_edge_idx; };
-vector<int> dijkstra_path(int src, int tgt) {
+// weak components by union-find over unblocked search edges; strong components
+// by an iterative Tarjan over adj when directed. Contracted nodes get id -1.
+void compute_components() {
     int n = adj.size();
-    const double INF = 1e18;
-    vector<double> dist(n, INF);
-    vector<int> prev(n, -1), prev_edge(n, -1);
+    vector<int> par(n);
+    iota(par.begin(), par.end(), 0);
+    auto find = [&](int x){ while(par[x] != x) x = par[x] = par[par[x]]; return x; };
+    for(size_t i=0;i<sedges.size();++i){
+        if(sedge_blocked[i]) continue;
+        int a = find(sedges[i].u), b = find(sedges[i].v);
+        if(a != b) par[max(a,b)] = min(a,b);
+    }
+    comp_id.assign(n, -1); comp_size.clear();
+    auto folded = [&](int v){ return v < (int)contracted.size() && contracted[v]; };
+    for(int v=0; v<n; ++v){
+        if(folded(v)) continue;
+        int r = find(v);
+        if(comp_id[r] == -1) { comp_id[r] = comp_size.size(); comp_size.push_back(0); }
+        comp_id[v] = comp_id[r];
+        comp_size[comp_id[v]]++;
+    }
+    if(!directed) { scc_id = comp_id; scc_size = comp_size; return; }
+    scc_id.assign(n, -1); scc_size.clear();
+    vector<int> idx(n, -1), low(n, 0), stk, call; // call stack holds (node, next arc position)
+    vector<int> pos(n, 0);
+    vector<char> on(n, 0);
+    int counter = 0;
+    for(int s=0; s<n; ++s){
+        if(idx[s] != -1 || folded(s)) continue;
+        call.push_back(s); idx[s] = low[s] = counter++; stk.push_back(s); on[s] = 1; pos[s] = adj.off[s];
+        while(!call.empty()){
+            int u = call.back();
+            if(pos[u] < adj.off[u+1]){
+                const Arc &a = adj.arcs[pos[u]++];
+                if(sedge_blocked[a.ei]) continue;
+                int v = a.to;
+                if(idx[v] == -1) { idx[v] = low[v] = counter++; stk.push_back(v); on[v] = 1; pos[v] = adj.off[v]; call.push_back(v); }
+                else if(on[v]) low[u] = min(low[u], idx[v]);
+                continue;
+            }
+            call.pop_back();
+            if(!call.empty()) low[call.back()] = min(low[call.back()], low[u]);
+            if(low[u] == idx[u]){
+                int id = scc_size.size(); scc_size.push_back(0);
+                int w;
+                do { w = stk.back(); stk.pop_back(); on[w] = 0; scc_id[w] = id; scc_size[id]++; } while(w != u);
+            }
+        }
+    }
+}
+
+// O(1) unreachable test: no path can leave a weak component
+bool maybe_reachable(int src, int tgt) {
+    return comp_id.empty() || comp_id[src] == comp_id[tgt];
+}
+
+// update fields for one edge (defaults when it has no entry)
+struct EdgeUpdate { double traffic_mul = 1.0, rain_mm = 0.0, road_adj = 0.0; bool blocked = false; };
+EdgeUpdate edge_update(const Edge &e) {
+    EdgeUpdate u;
+    auto it = updates_by_edge.find(e.edge_id);
+    if(it == updates_by_edge.end()) return u;
+    const json &obj = it->second;
+    if(obj.contains("traffic_multiplier")) u.traffic_mul = (double)obj["traffic_multiplier"];
+    if(obj.contains("rain_mm_hr")) u.rain_mm = (double)obj["rain_mm_hr"];
+    if(obj.contains("blocked")) u.blocked = (bool)obj["blocked"];
+    if(obj.contains("road_quality_adjust")) u.road_adj = (double)obj["road_quality_adjust"];
+    return u;
+}
+
+// traffic multiplier of an edge: the --history slot when it covers the edge, else updates.json
+double edge_traffic(int edge_index) {
+    if(!traffic_slice.empty() && traffic_slice[edge_index] >= 0) return traffic_slice[edge_index];
+    return edge_update(edges[edge_index]).traffic_mul;
+}
+
+// travel time in seconds under the current traffic multiplier
+double edge_time(int edge_index) {
+    return edges[edge_index].freeflow_time_s * edge_traffic(edge_index);
+}
+
+struct CostWeights { double time, traffic, weather, road_qual, safety, block; };
+CostWeights current_weights() { return {W_TIME, W_TRAFFIC, W_WEATHER, W_ROAD_QUAL, W_SAFETY, W_BLOCK}; }
+
+// out[b,e) = blocked ? block : dist + traffic*W + rain*W + road*W + safety*W + time*W.
+// Every variant adds in that order without FMA, so all give the same bits.
+void cost_kernel_scalar(const CostTerms &t, const CostWeights &w, double *out, size_t b, size_t e) {
+    for(size_t i=b;i<e;++i){
+        double c = t.dist[i] + t.traffic[i]*w.traffic + t.rain[i]*w.weather + t.road[i]*w.road_qual + t.safety[i]*w.safety + t.time[i]*w.time;
+        out[i] = t.blocked[i] != 0.0 ? w.block : c;
+    }
+}
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+__attribute__((target("avx2")))
+void cost_kernel_avx2(const CostTerms &t, const CostWeights &w, double *out, size_t b, size_t e) {
+    const __m256d wt = _mm256_set1_pd(w.traffic), ww = _mm256_set1_pd(w.weather), wr = _mm256_set1_pd(w.road_qual),
+                  ws = _mm256_set1_pd(w.safety), wtime = _mm256_set1_pd(w.time), wb = _mm256_set1_pd(w.block), zero = _mm256_setzero_pd();
+    size_t i = b;
+    for(; i+4<=e; i+=4){
+        __m256d c = _mm256_loadu_pd(&t.dist[i]);
+        c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&t.traffic[i]), wt));
+        c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&t.rain[i]), ww));
+        c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&t.road[i]), wr));
+        c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&t.safety[i]), ws));
+        c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&t.time[i]), wtime));
+        __m256d blk = _mm256_cmp_pd(_mm256_loadu_pd(&t.blocked[i]), zero, _CMP_NEQ_OQ);
+        _mm256_storeu_pd(out + i, _mm256_blendv_pd(c, wb, blk));
+    }
+    cost_kernel_scalar(t, w, out, i, e);
+}
+__attribute__((target("sse2")))
+void cost_kernel_sse2(const CostTerms &t, const CostWeights &w, double *out, size_t b, size_t e) {
+    const __m128d wt = _mm_set1_pd(w.traffic), ww = _mm_set1_pd(w.weather), wr = _mm_set1_pd(w.road_qual),
+                  ws = _mm_set1_pd(w.safety), wtime = _mm_set1_pd(w.time), wb = _mm_set1_pd(w.block), zero = _mm_setzero_pd();
+    size_t i = b;
+    for(; i+2<=e; i+=2){
+        __m128d c = _mm_loadu_pd(&t.dist[i]);
+        c = _mm_add_pd(c, _mm_mul_pd(_mm_loadu_pd(&t.traffic[i]), wt));
+        c = _mm_add_pd(c, _mm_mul_pd(_mm_loadu_pd(&t.rain[i]), ww));
+        c = _mm_add_pd(c, _mm_mul_pd(_mm_loadu_pd(&t.road[i]), wr));
+        c = _mm_add_pd(c, _mm_mul_pd(_mm_loadu_pd(&t.safety[i]), ws));
+        c = _mm_add_pd(c, _mm_mul_pd(_mm_loadu_pd(&t.time[i]), wtime));
+        __m128d blk = _mm_cmpneq_pd(_mm_loadu_pd(&t.blocked[i]), zero);
+        _mm_storeu_pd(out + i, _mm_or_pd(_mm_and_pd(blk, wb), _mm_andnot_pd(blk, c)));
+    }
+    cost_kernel_scalar(t, w, out, i, e);
+}
+#endif
+
+using CostKernel = void (*)(const CostTerms &, const CostWeights &, double *, size_t, size_t);
+// picked once from the running CPU, so the default -O2 build still gets AVX2 where available
+pair<CostKernel, const char *> cost_kernel() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if(__builtin_cpu_supports("avx2")) return {cost_kernel_avx2, "avx2"};
+    if(__builtin_cpu_supports("sse2")) return {cost_kernel_sse2, "sse2"};
+#endif
+    return {cost_kernel_scalar, "scalar"};
+}
+
+// recompute sedge_cost from cost_terms under w; enough after a weight change
+void apply_cost_weights(const CostWeights &w, vector<double> &out) {
+    TraceScope ts("apply_cost_weights");
+    static const CostKernel kernel = cost_kernel().first;
+    out.resize(cost_terms.dist.size());
+    parallel_chunks(out.size(), [&](size_t b, size_t e){ kernel(cost_terms, w, out.data(), b, e); }, 1<<18);
+}
+
+// cost_terms and sedge_time of search edge i from its members' updates
+void gather_sedge_terms(size_t i) {
+    CostTerms &t = cost_terms;
+    double d = 0, tr = 0, rn = 0, rq = 0, sf = 0, tm = 0, tt = 0, blk = 0;
+    for(int k=sedge_off[i];k<sedge_off[i+1];++k){
+        const Edge &ed = edges[sedge_members[k]];
+        EdgeUpdate u = edge_update(ed);
+        if(!traffic_slice.empty() && traffic_slice[sedge_members[k]] >= 0) u.traffic_mul = traffic_slice[sedge_members[k]];
+        if(u.blocked) blk = 1;
+        d += ed.distance_m; tr += u.traffic_mul - 1.0; rn += u.rain_mm;
+        rq += (10.0 - ed.road_quality - u.road_adj)/10.0; sf += (10.0 - ed.safety_index)/10.0;
+        tm += ed.freeflow_time_s; tt += ed.freeflow_time_s * u.traffic_mul;
+    }
+    t.dist[i] = d; t.traffic[i] = tr; t.rain[i] = rn; t.road[i] = rq; t.safety[i] = sf; t.time[i] = tm; t.blocked[i] = blk;
+    sedge_time[i] = tt;
+}
+
+// read the updates once per edge into cost_terms (and sedge_time)
+void gather_cost_terms() {
+    TraceScope ts("gather_cost_terms");
+    size_t m = sedges.size();
+    CostTerms &t = cost_terms;
+    for(auto *col : {&t.dist, &t.traffic, &t.rain, &t.road, &t.safety, &t.time, &t.blocked}) col->resize(m);
+    sedge_time.resize(m);
+    parallel_chunks(m, [&](size_t b, size_t e){ for(size_t i=b;i<e;++i) gather_sedge_terms(i); });
+}
+
+// named weight profiles, each with its own compiled cost column kept next to
+// sedge_cost (which is the default profile, i.e. the W_* globals). Built-ins
+// are balanced/fastest/safest; --profiles file.json adds or overrides them:
+//   {"commuter": {"time": 4, "traffic": 900, "weather": 100, "road_quality": 50, "safety": 50}, ...}
+// Missing keys keep the balanced value. Requests pick a column by name; only
+// profiles marked in use get a column, so single queries pay for one.
+struct Profile { string name; CostWeights w; vector<double> cost; bool in_use = false; };
+vector<Profile> profiles = {
+    {"balanced", {1.0, 300.0, 250.0, 200.0, 180.0, 1e7}, {}},
+    {"fastest",  {10.0, 3000.0, 100.0, 0.0, 0.0, 1e7}, {}},
+    {"safest",   {0.5, 150.0, 1000.0, 1000.0, 2000.0, 1e7}, {}},
+};
+
+Profile *find_profile(const string &name) {
+    for(auto &p: profiles) if(p.name == name) return &p;
+    return nullptr;
+}
+
+bool load_profiles(const string &path) {
+    ifstream f(path);
+    if(!f) return false;
+    json j = json::parse(f, nullptr, false);
+    if(j.is_discarded() || !j.is_object()) return false;
+    for(auto it = j.begin(); it != j.end(); ++it){
+        if(!it.value().is_object()) { cerr << "profiles: " << it.key() << " is not an object\n"; return false; }
+        CostWeights w = profiles[0].w;
+        const json &o = it.value();
+        for(auto &[key, field] : {pair<const char*, double*>{"time", &w.time}, {"traffic", &w.traffic}, {"weather", &w.weather},
+                                  {"road_quality", &w.road_qual}, {"safety", &w.safety}}){
+            if(!o.contains(key)) continue;
+            if(!o[key].is_number()) { cerr << "profiles: " << it.key() << "." << key << " is not a number\n"; return false; }
+            *field = o[key].get<double>();
+        }
+        if(Profile *p = find_profile(it.key())) p->w = w;
+        else profiles.push_back({it.key(), w, {}, false});
+    }
+    return true;
+}
+
+// make a profile the default: its weights become the W_* globals behind sedge_cost
+bool use_profile(const string &name) {
+    Profile *p = find_profile(name);
+    if(!p) return false;
+    W_TIME = p->w.time; W_TRAFFIC = p->w.traffic; W_WEATHER = p->w.weather; W_ROAD_QUAL = p->w.road_qual; W_SAFETY = p->w.safety;
+    return true;
+}
+
+// cost column for a request's profile ("" = default), nullptr if unknown or not in use
+const vector<double> *profile_cost(const string &name) {
+    if(name.empty()) return &sedge_cost;
+    Profile *p = find_profile(name);
+    return p && p->in_use ? &p->cost : nullptr;
+}
+
+// cost of every search edge = sum of its member edges; blocked if any member is.
+// Components are recomputed only when the blocked set actually changed.
+void compile_costs() {
+    TraceScope ts("compile_costs");
+    gather_cost_terms();
+    apply_cost_weights(current_weights(), sedge_cost);
+    for(auto &p: profiles) if(p.in_use) apply_cost_weights(p.w, p.cost);
+    vector<char> blocked(sedges.size());
+    for(size_t i=0;i<sedges.size();++i) blocked[i] = sedge_cost[i] >= W_BLOCK;
+    if(blocked != sedge_blocked || comp_id.size() != adj.size()) {
+        sedge_blocked.swap(blocked);
+        compute_components();
+    }
+}
+
+// compile_costs for just these search edges, after an updates change that
+// touched only them; components are redone only if the blocked set changed
+void refresh_costs(const vector<int> &ids) {
+    TraceScope ts("refresh_costs");
+    static const CostKernel kernel = cost_kernel().first;
+    CostWeights w = current_weights();
+    bool flipped = false;
+    for(int i : ids){
+        gather_sedge_terms(i);
+        kernel(cost_terms, w, sedge_cost.data(), i, i+1);
+        for(auto &p: profiles) if(p.in_use) kernel(cost_terms, p.w, p.cost.data(), i, i+1);
+        char b = sedge_cost[i] >= W_BLOCK;
+        if(b != sedge_blocked[i]) { sedge_blocked[i] = b; flipped = true; }
+    }
+    if(flipped) compute_components();
+}
+
+// graph simplification (--simplify):
+//  1. drop self loops. Parallel edges all stay, each its own search edge: which
+//     one is cheaper (or blocked) depends on the updates, and those change
+//     under --watch, --history and --depart, so the search picks per query
+//  2. fold every unpinned node with exactly two incident edges into a chain, so
+//     searches see one search edge per chain; members keep the unpacking order
+struct SimplifyStats { int edges_in=0, loops_dropped=0, nodes_contracted=0, sedges_out=0; };
+SimplifyStats simplify_graph(const vector<char> &pinned) {
+    TraceScope ts("simplify_graph");
+    SimplifyStats st; st.edges_in = edges.size();
+    int n = adj.size(), m = edges.size();
+    vector<char> alive(m, 1);
+    for(int i=0;i<m;++i) if(edges[i].u == edges[i].v) { alive[i] = 0; st.loops_dropped++; } // a self loop never helps
+    // undirected incidence of the surviving edges
+    vector<int> ioff(n+1, 0), inc;
+    for(int i=0;i<m;++i) if(alive[i]) { ioff[edges[i].u+1]++; ioff[edges[i].v+1]++; }
+    for(int v=0; v<n; ++v) ioff[v+1] += ioff[v];
+    inc.resize(ioff[n]);
+    { vector<int> cur(ioff.begin(), ioff.end()-1);
+      for(int i=0;i<m;++i) if(alive[i]) { inc[cur[edges[i].u]++] = i; inc[cur[edges[i].v]++] = i; } }
+    auto other = [&](int e, int x){ return edges[e].u == x ? edges[e].v : edges[e].u; };
+    vector<char> fold(n, 0);
+    for(int x=0; x<n; ++x){
+        if((x < (int)pinned.size() && pinned[x]) || ioff[x+1]-ioff[x] != 2) continue;
+        int e1 = inc[ioff[x]], e2 = inc[ioff[x]+1];
+        if(other(e1,x) == other(e2,x)) continue;
+        bool ok = true;
+        if(directed && (edges[e1].oneway || edges[e2].oneway))
+            ok = edges[e1].oneway && edges[e2].oneway && ((edges[e1].v == x) != (edges[e2].v == x));
+        fold[x] = ok;
+    }
+    vector<SEdge> ns;
+    vector<int> noff{0}, nmem;
+    vector<char> used(m, 0);
+    auto walk = [&](int s, int e){
+        size_t first = nmem.size();
+        int cur = s; double dist = 0, t = 0; bool ow = false;
+        while(true){
+            used[e] = 1; nmem.push_back(e);
+            dist += edges[e].distance_m; t += edges[e].freeflow_time_s;
+            ow |= directed && edges[e].oneway;
+            int nxt = other(e, cur);
+            if(!fold[nxt] || nxt == s) { cur = nxt; break; }
+            int a = inc[ioff[nxt]], b = inc[ioff[nxt]+1];
+            e = (a == e) ? b : a; cur = nxt;
+        }
+        int u = s, v = cur;
+        // a oneway chain is stored in its driving direction
+        if(ow && edges[nmem[first]].u != s) { reverse(nmem.begin()+first, nmem.end()); swap(u, v); }
+        ns.push_back({u, v, ow, dist, t});
+        noff.push_back((int)nmem.size());
+    };
+    for(int x=0; x<n; ++x) if(!fold[x])
+        for(int k=ioff[x]; k<ioff[x+1]; ++k) if(!used[inc[k]]) walk(x, inc[k]);
+    // rings made only of foldable nodes: break them at their first node
+    for(int x=0; x<n; ++x) if(fold[x])
+        for(int k=ioff[x]; k<ioff[x+1]; ++k) if(!used[inc[k]]) { fold[x] = 0; walk(x, inc[k]); }
+    contracted.assign(nodes.size(), 0);
+    for(int x=0; x<n && x<(int)nodes.size(); ++x) { contracted[x] = fold[x]; st.nodes_contracted += fold[x]; }
+    sedges.swap(ns); sedge_off.swap(noff); sedge_members.swap(nmem);
+    st.sedges_out = sedges.size();
+    rebuild_graph();
+    return st;
+}
+
+// per-thread search state, so queries never touch shared mutable data. Arrays
+// are reset in O(1) by bumping an epoch; forbidden search edges are marked the
+// same way, which replaces blocking costs in the shared graph.
+struct SearchWorkspace {
+    static constexpr double INF = 1e18;
+    vector<double> dist[2];
+    vector<int> prev[2];
+    vector<uint32_t> stamp[2];
+    vector<uint32_t> forbid;
+    uint32_t epoch = 0, forbid_epoch = 0;
+    vector<pair<double,int>> heap[2];
+
+    void prepare(size_t n, size_t m) {
+        for(int s=0;s<2;++s) if(dist[s].size() != n) { dist[s].assign(n, INF); prev[s].assign(n, -1); stamp[s].assign(n, 0); }
+        if(forbid.size() != m) { forbid.assign(m, 0); forbid_epoch = 0; }
+        if(++epoch == 0) { for(int s=0;s<2;++s) fill(stamp[s].begin(), stamp[s].end(), 0); epoch = 1; }
+        heap[0].clear(); heap[1].clear();
+    }
+    double d(int s, int v) const { return stamp[s][v] == epoch ? dist[s][v] : INF; }
+    void set(int s, int v, double dd, int p) { stamp[s][v] = epoch; dist[s][v] = dd; prev[s][v] = p; }
+    int pre(int s, int v) const { return stamp[s][v] == epoch ? prev[s][v] : -1; }
+    void set_forbidden(const vector<int> &sedge_ids) {
+        if(++forbid_epoch == 0) { fill(forbid.begin(), forbid.end(), 0); forbid_epoch = 1; }
+        for(int e : sedge_ids) forbid[e] = forbid_epoch;
+    }
+    bool forbidden(int e) const { return forbid[e] == forbid_epoch; }
+};
+
+SearchWorkspace& local_workspace() {
+    thread_local SearchWorkspace ws;
+    return ws;
+}
+
+// cost policies for the search: cost(ei) is the search edge's cost, >= 1e6 when
+// blocked. CompiledCost reads a precompiled column (the normal path); TermCost
+// evaluates cost_terms on the fly with only the terms in Mask compiled in, and
+// GenericCost is the same with the mask tested at runtime. TermCost<T_ALL>
+// adds in the kernel's order, so it matches the compiled column bit for bit.
+enum : unsigned { T_DIST = 1, T_TRAFFIC = 2, T_RAIN = 4, T_ROAD = 8, T_SAFETY = 16, T_TIME = 32, T_ALL = 63 };
+struct CompiledCost {
+    const double *c;
+    double operator()(int ei) const { return c[ei]; }
+};
+template<unsigned Mask> struct TermCost {
+    const CostTerms *t; CostWeights w;
+    double operator()(int ei) const {
+        if(t->blocked[ei] != 0.0) return w.block;
+        double c = 0.0;
+        if constexpr((Mask & T_DIST) != 0) c += t->dist[ei];
+        if constexpr((Mask & T_TRAFFIC) != 0) c += t->traffic[ei]*w.traffic;
+        if constexpr((Mask & T_RAIN) != 0) c += t->rain[ei]*w.weather;
+        if constexpr((Mask & T_ROAD) != 0) c += t->road[ei]*w.road_qual;
+        if constexpr((Mask & T_SAFETY) != 0) c += t->safety[ei]*w.safety;
+        if constexpr((Mask & T_TIME) != 0) c += t->time[ei]*w.time;
+        return c;
+    }
+};
+using DistanceCost = TermCost<T_DIST>;
+using CompositeCost = TermCost<T_ALL>;
+// congested travel time in seconds
+struct TimeCost {
+    const double *t, *blocked;
+    double operator()(int ei) const { return blocked[ei] != 0.0 ? W_BLOCK : t[ei]; }
+};
+struct GenericCost {
+    const CostTerms *t; CostWeights w; unsigned mask;
+    double operator()(int ei) const {
+        if(t->blocked[ei] != 0.0) return w.block;
+        double c = 0.0;
+        if(mask & T_DIST) c += t->dist[ei];
+        if(mask & T_TRAFFIC) c += t->traffic[ei]*w.traffic;
+        if(mask & T_RAIN) c += t->rain[ei]*w.weather;
+        if(mask & T_ROAD) c += t->road[ei]*w.road_qual;
+        if(mask & T_SAFETY) c += t->safety[ei]*w.safety;
+        if(mask & T_TIME) c += t->time[ei]*w.time;
+        return c;
+    }
+};
+// terms a weight set actually uses (distance always counts in the composite)
+unsigned term_mask(const CostWeights &w) {
+    return T_DIST | (w.traffic != 0 ? unsigned(T_TRAFFIC) : 0u) | (w.weather != 0 ? unsigned(T_RAIN) : 0u) | (w.road_qual != 0 ? unsigned(T_ROAD) : 0u)
+         | (w.safety != 0 ? unsigned(T_SAFETY) : 0u) | (w.time != 0 ? unsigned(T_TIME) : 0u);
+}
+
+// Dijkstra to compute single shortest path using composite edge cost.
+// Bidirectional: forward over adj from src, backward over rev_adj() from tgt,
+// stopping once the two frontiers can no longer improve the best meeting.
+// Reads only shared read-only graph data; forbidden search edges are skipped.
+template<class Cost>
+vector<int> dijkstra_search(SearchWorkspace &ws, int src, int tgt, const vector<int> &forbidden, const Cost &cost) {
+    if(src == tgt) return {src};
+    TraceScope ts("dijkstra_path");
+    if(!maybe_reachable(src, tgt)) { if(collect_stats) add_search_stats(0, 0, 0, 0); return {}; }
+    const double INF = SearchWorkspace::INF;
+    const CSR &radj_ = rev_adj();
+    ws.prepare(adj.size(), sedges.size());
+    ws.set_forbidden(forbidden);
     using P = pair<double,int>;
-    priority_queue<P, vector<P>, greater<P>> pq;
-    dist[src] = 0.0; pq.push({0.0, src});
-    while(!pq.empty()){
-        auto pr = pq.top(); pq.pop();
+    auto cmp = greater<P>();
+    ws.set(0, src, 0.0, -1); ws.heap[0].push_back({0.0, src});
+    ws.set(1, tgt, 0.0, -1); ws.heap[1].push_back({0.0, tgt});
+    double best = INF; int meet = -1;
+    uint64_t settled = 0, relaxed = 0, pushes = 2, pops = 0;
+    while(!ws.heap[0].empty() && !ws.heap[1].empty()){
+        if(ws.heap[0].front().first + ws.heap[1].front().first >= best) break;
+        int side = ws.heap[0].front().first <= ws.heap[1].front().first ? 0 : 1;
+        auto &hp = ws.heap[side];
+        pop_heap(hp.begin(), hp.end(), cmp);
+        auto pr = hp.back(); hp.pop_back(); pops++;
         double d = pr.first; int u = pr.second;
-        if(d > dist[u]) continue;
-        if(u == tgt) break;
-        for(auto pr2: adj[u]){
-            int v = pr2.first; int ei = pr2.second;
-            double c = edge_cost(ei);
-            if(c >= 1e6) continue; // blocked
+        if(d > ws.d(side, u)) continue;
+        settled++;
+        const CSR &g = side == 0 ? adj : radj_;
+        for(auto &a: g[u]){
+            int v = a.to; int ei = a.ei;
+            double c = cost(ei);
+            if(c >= 1e6 || ws.forbidden(ei)) continue; // blocked
+            relaxed++;
             double nd = d + c;
-            if(nd + 1e-9 < dist[v]) {
-                dist[v] = nd; prev[v] = u; prev_edge[v] = ei;
-                pq.push({nd, v});
+            if(nd + 1e-9 < ws.d(side, v)) {
+                ws.set(side, v, nd, u);
+                hp.push_back({nd, v}); push_heap(hp.begin(), hp.end(), cmp); pushes++;
+                double other = ws.d(1-side, v);
+                if(nd + other < best) { best = nd + other; meet = v; }
             }
         }
     }
-    if(dist[tgt] >= 1e17) return {};
+    if(collect_stats) add_search_stats(settled, relaxed, pushes, pops);
+    if(ts.on) ts.args = "{\"settled\":" + to_string(settled) + ",\"relaxed\":" + to_string(relaxed) + "}";
+    if(meet == -1) return {};
     vector<int> path_nodes;
-    int cur = tgt;
-    while(cur != -1) {
-        path_nodes.push_back(cur);
-        cur = prev[cur];
-    }
+    for(int cur = meet; cur != -1; cur = ws.pre(0, cur)) path_nodes.push_back(cur);
     reverse(path_nodes.begin(), path_nodes.end());
+    for(int cur = ws.pre(1, meet); cur != -1; cur = ws.pre(1, cur)) path_nodes.push_back(cur);
     return path_nodes;
 }
 
-// write path.json
+vector<int> dijkstra_path(SearchWorkspace &ws, int src, int tgt, const vector<int> &forbidden, const vector<double> &cost = sedge_cost) {
+    return dijkstra_search(ws, src, tgt, forbidden, CompiledCost{cost.data()});
+}
+
+vector<int> dijkstra_path(int src, int tgt) {
+    return dijkstra_path(local_workspace(), src, tgt, {});
+}
+
+// cheapest search edge from a to b under cost (parallel arcs may remain), -1 if none
+int arc_between(int a, int b, const vector<double> &cost = sedge_cost) {
+    int best = -1;
+    for(auto &pr: adj[a])
+        if(pr.to == b && (best == -1 || cost[pr.ei] < cost[best])) best = pr.ei;
+    return best;
+}
+
+// search edges a route takes under cost: two routes over the same nodes can
+// still differ here, on parallel edges or on two chains between the same ends
+vector<int> route_arcs(const vector<int> &r, const vector<double> &cost = sedge_cost) {
+    vector<int> arcs;
+    for(size_t z=0; z+1<r.size(); ++z) arcs.push_back(arc_between(r[z], r[z+1], cost));
+    return arcs;
+}
+
+double route_distance(const vector<int> &r, const vector<double> &cost = sedge_cost) {
+    double total_m = 0.0;
+    for(size_t z=0; z+1<r.size(); ++z){
+        int si = arc_between(r[z], r[z+1], cost);
+        if(si != -1) total_m += sedges[si].distance_m;
+    }
+    return total_m;
+}
+
+// unpack contracted chains so the route lists every original node
+vector<int> expand_route(const vector<int> &r, const vector<double> &cost = sedge_cost) {
+    if(r.empty()) return r;
+    vector<int> out{r[0]};
+    for(size_t z=0; z+1<r.size(); ++z){
+        int si = arc_between(r[z], r[z+1], cost);
+        if(si == -1 || sedge_off[si+1]-sedge_off[si] == 1) { out.push_back(r[z+1]); continue; }
+        int cur = r[z];
+        bool fwd = sedges[si].u == cur;
+        for(int k=0, cnt=sedge_off[si+1]-sedge_off[si]; k<cnt; ++k){
+            const Edge &e = edges[sedge_members[fwd ? sedge_off[si]+k : sedge_off[si+1]-1-k]];
+            cur = (e.u == cur) ? e.v : e.u;
+            out.push_back(cur);
+        }
+    }
+    return out;
+}
+
+// one route as written to path.json: totals plus every (unpacked) point
+json route_json(const vector<int> &route, int id, const vector<double> &cost = sedge_cost) {
+    json r;
+    r["id"] = id;
+    double total_m = 0.0;
+    double total_time = 0.0;
+    for(size_t k=0;k+1<route.size(); ++k){
+        int si = arc_between(route[k], route[k+1], cost);
+        if(si == -1) continue;
+        total_m += sedges[si].distance_m;
+        total_time += sedges[si].freeflow_time_s;
+    }
+    vector<json> pts;
+    for(int nid : expand_route(route, cost)){
+        json p;
+        p["name"] = string(node_name(nid));
+        p["lat"] = nodes[nid].lat;
+        p["lon"] = nodes[nid].lon;
+        pts.push_back(p);
+    }
+    r["distance_m"] = total_m;
+    r["duration_min"] = (int)round(total_time / 60.0);
+    r["points"] = pts;
+    return r;
+}
+
 void write_path_json(const vector<vector<int>>& routes, const string &outfn) {
+    TraceScope ts("write_path_json");
     json j;
     j["routes"] = json::array();
-    for(size_t i=0;i<routes.size();++i){
-        json r;
-        r["id"] = (int)i;
-        double total_m = 0.0;
-        double total_time = 0.0;
-        vector<json> pts;
-        for(size_t k=0;k<routes[i].size(); ++k){
-            int nid = routes[i][k];
-            json p;
-            p["name"] = nodes[nid].name;
-            p["lat"] = nodes[nid].lat;
-            p["lon"] = nodes[nid].lon;
-            pts.push_back(p);
-            if(k+1<routes[i].size()){
-                // find edge between k and k+1
-                int u = routes[i][k], v=routes[i][k+1];
-                for(auto pr: adj[u]){
-                    if(pr.first == v){
-                        Edge &ee = edges[pr.second];
-                        total_m += ee.distance_m;
-                        total_time += ee.freeflow_time_s;
-                        break;
-                    }
-                }
-            }
-        }
-        r["distance_m"] = total_m;
-        r["duration_min"] = (int)round(total_time / 60.0);
-        r["points"] = pts;
-        j["routes"].push_back(r);
+    {
+        PhaseTimer pt(phase_times.output_ms);
+        for(size_t i=0;i<routes.size();++i) j["routes"].push_back(route_json(routes[i], (int)i));
     }
+    if(collect_stats) j["stats"] = stats_json();
     ofstream fo(outfn);
     fo<<setw(2)<<j;
     fo.close();
     cout<<"Wrote "<<outfn<<"\n";
 }
 
-// simple K-short: Yen-lite (remove one edge from best path to produce alternatives)
-vector<vector<int>> k_short_simple(int src, int tgt, int K) {
+// simple K-short: Yen-lite (remove one edge from best path to produce alternatives).
+// Each spur search forbids a->b in its own thread's workspace, so the spurs of a
+// round are independent and run in parallel on pool; candidates are merged in
+// hop order afterwards, giving the same result as the sequential loop.
+vector<vector<int>> k_short_simple(SearchWorkspace &ws, int src, int tgt, int K, ThreadPool *pool, const vector<double> &cost = sedge_cost) {
+    TraceScope ts("k_short_simple");
     vector<vector<int>> result;
-    vector<int> best = dijkstra_path(src,tgt);
+    vector<int> best;
+    { PhaseTimer pt(phase_times.search_ms); best = dijkstra_path(ws, src, tgt, {}, cost); }
     if(best.empty()) return result;
     result.push_back(best);
+    PhaseTimer pt(phase_times.kpaths_ms);
     set<pair<double, vector<int>>> candidate_set;
     for(int k=1;k<K;++k){
+        TraceScope tk("k_round");
+        if(tk.on) tk.args = "{\"k\":" + to_string(k) + "}";
         // take last found path and remove each edge
         vector<int> base = result.back();
-        for(size_t i=0;i+1<base.size();++i){
+        vector<vector<int>> spur(base.size() > 0 ? base.size()-1 : 0);
+        pool_for(pool, spur.size(), [&](size_t i){
             int a = base[i], b = base[i+1];
-            // forbid all edges connecting a->b temporarily by setting updates for their edge_id blocked
-            vector<int> changed;
-            unordered_map<int,json> orig;
-            for(auto pr: adj[a]){
-                if(pr.first == b){
-                    int ei = pr.second;
-                    if(updates_by_edge.count(edges[ei].edge_id)==0) continue;
-                    orig[edges[ei].edge_id] = updates_by_edge[edges[ei].edge_id];
-                    updates_by_edge[edges[ei].edge_id]["blocked"] = true;
-                    changed.push_back(edges[ei].edge_id);
-                }
-            }
-            // recompute path
-            vector<int> np = dijkstra_path(src,tgt);
-            // restore updates
-            for(auto c: changed){
-                updates_by_edge[c] = orig[c];
-            }
-            if(!np.empty()){
-                double dist = 0.0;
-                for(size_t z=0;z+1<np.size();++z){
-                    // find edge
-                    for(auto pr: adj[np[z]]){
-                        if(pr.first == np[z+1]) { dist += edges[pr.second].distance_m; break; }
-                    }
-                }
-                candidate_set.insert({dist, np});
-            }
-        }
+            // forbid all search edges connecting a->b for this search only
+            vector<int> forb;
+            for(auto &pr: adj[a]) if(pr.to == b) forb.push_back(pr.ei);
+            // recompute path (the caller's workspace is idle while it runs spurs)
+            SearchWorkspace &w = pool ? local_workspace() : ws;
+            spur[i] = dijkstra_path(w, src, tgt, forb, cost);
+        });
+        for(auto &np: spur)
+            if(!np.empty()) candidate_set.insert({route_distance(np, cost), move(np)});
         if(candidate_set.empty()) break;
         auto it = candidate_set.begin();
         result.push_back(it->second);
@@ -249,84 +1113,2130 @@ vector<vector<int>> k_short_simple(int src, int tgt, int K) {
     return result;
 }
 
+vector<vector<int>> k_short_simple(int src, int tgt, int K) {
+    return k_short_simple(local_workspace(), src, tgt, K, engine_pool);
+}
+
 int find_node_id_by_name(const string &q) {
-    for(auto &n: nodes) if(n.name == q) return n.id;
-    // try case-insensitive or substring match
-    for(auto &n: nodes) {
-        string s = n.name, t = q;
+    int nm = names.find(q);
+    if(nm != -1) return names.first_node[nm];
+    // try case-insensitive or substring match, once per unique name instead of per node
+    string t = q;
+    transform(t.begin(), t.end(), t.begin(), ::tolower);
+    string s;
+    for(uint32_t id=0; id<names.size(); ++id) {
+        string_view v = names.get(id);
+        s.assign(v.begin(), v.end());
         transform(s.begin(), s.end(), s.begin(), ::tolower);
-        transform(t.begin(), t.end(), t.begin(), ::tolower);
-        if(s.find(t) != string::npos) return n.id;
+        if(s.find(t) != string::npos) return names.first_node[id];
     }
     return -1;
 }
 
-int main(int argc, char** argv) {
-    if(argc < 6) {
-        cerr<<"Usage: safepath_core nodes.csv edges.csv updates.json \"start_name\" \"dest_name\" [K]\n";
-        return 1;
+// exact name, then a bare number as node id, then the substring fallback
+int resolve_node(const string &q) {
+    int nm = names.find(q);
+    if(nm != -1) return names.first_node[nm];
+    if(!q.empty() && q.size() < 10 && q.find_first_not_of("0123456789") == string::npos) {
+        int v = stoi(q);
+        if(v < (int)adj.size()) return v;
     }
-    string nodes_file = argv[1], edges_file = argv[2], updates_file = argv[3];
-    string start_name = argv[4], dest_name = argv[5];
-    int K = 3;
-    if(argc >= 7) K = stoi(argv[6]);
+    return find_node_id_by_name(q);
+}
 
-    if(!load_nodes(nodes_file)) { cerr<<"Cannot load nodes\n"; return 1; }
-    if(!load_edges(edges_file)) { cerr<<"Cannot load edges\n"; return 1; }
-    if(!load_updates(updates_file)) { cerr<<"Cannot load updates\n"; return 1; }
+// pin the query endpoints, run --simplify if asked, then compile costs (timed as cost compile)
+void prepare_graph(const vector<int> &endpoints, bool simplify) {
+    stat_clock::time_point t_compile = stat_clock::now();
+    if(simplify) {
+        vector<char> pinned(adj.size(), 0);
+        for(int v : endpoints) if(v >= 0) pinned[v] = 1;
+        auto st = simplify_graph(pinned);
+        cerr << "simplify: " << st.edges_in << " edges -> " << st.sedges_out << " search edges ("
+             << st.loops_dropped << " self loops dropped, " << st.nodes_contracted << " nodes contracted)\n";
+    }
+    compile_costs();
+    if(collect_stats) phase_times.compile_ms += chrono::duration<double, milli>(stat_clock::now() - t_compile).count();
+}
 
-    int src = find_node_id_by_name(start_name);
-    int tgt = find_node_id_by_name(dest_name);
-    if(src==-1 || tgt==-1) {
-        cerr<<"Start or dest node not found. Use exact name from nodes.csv\n";
-        for(auto &n : nodes) cerr << n.name << "\n";
-        return 1;
+// batch mode: many (start, dest, K) requests against one loaded graph and one
+// updates snapshot. Input is CSV with a header naming start,dest[,K][,id] or
+// NDJSON objects {"start":..,"dest":..,"K":..,"id":..,"profile":..}; one JSON result per line.
+// A line with a bad start, dest or K still gets its result line, carrying the error.
+struct BatchRequest { string id, start, dest, profile, error; int K = 3; int src = -1, tgt = -1; };
+const int MAX_BATCH_K = 100;
+
+// K from a batch field: a whole number in 1..MAX_BATCH_K, else -1
+int batch_k(const string &s) {
+    int k = 0, used = 0;
+    if(sscanf(s.c_str(), "%d%n", &k, &used) != 1 || used != (int)s.size() || k < 1 || k > MAX_BATCH_K) return -1;
+    return k;
+}
+
+bool read_batch(const string &path, vector<BatchRequest> &out) {
+    ifstream f(path);
+    if(!f) return false;
+    string line;
+    vector<string> parts, header;
+    int c_start = 0, c_dest = 1, c_k = 2, c_id = -1, c_profile = -1;
+    bool first = true;
+    while(getline(f,line)){
+        if(line.empty() || line == "\r") continue;
+        BatchRequest r;
+        if(line[0] == '{') {
+            json j = json::parse(line, nullptr, false);
+            if(j.is_discarded() || !j.contains("start") || !j.contains("dest")) { cerr << "batch: bad line: " << line << "\n"; continue; }
+            auto str = [](const json &v){ return v.is_string() ? v.get<string>() : v.dump(); };
+            r.start = str(j["start"]); r.dest = str(j["dest"]);
+            if(!(j["start"].is_string() || j["start"].is_number_integer()) || !(j["dest"].is_string() || j["dest"].is_number_integer()))
+                r.error = "start and dest must be names or node ids";
+            if(j.contains("K")) {
+                const json &k = j["K"];
+                r.K = k.is_number_integer() && k.get<long long>() >= 1 && k.get<long long>() <= MAX_BATCH_K ? k.get<int>() : -1;
+                if(r.K == -1) r.error = "K must be a whole number in 1.." + to_string(MAX_BATCH_K);
+            }
+            if(j.contains("id")) r.id = str(j["id"]);
+            if(j.contains("profile")) r.profile = str(j["profile"]);
+        } else {
+            size_t nf = split_csv(line, parts);
+            if(first) {
+                first = false;
+                header.assign(parts.begin(), parts.begin()+nf);
+                for(auto &h: header) transform(h.begin(), h.end(), h.begin(), ::tolower);
+                auto col = [&](const string &name){ auto it = find(header.begin(), header.end(), name); return it == header.end() ? -1 : (int)(it - header.begin()); };
+                if(col("start") != -1 && col("dest") != -1) { c_start = col("start"); c_dest = col("dest"); c_k = col("k"); c_id = col("id"); c_profile = col("profile"); continue; }
+            }
+            if((int)nf <= max(c_start, c_dest)) continue;
+            r.start = parts[c_start]; r.dest = parts[c_dest];
+            if(c_k >= 0 && c_k < (int)nf && !parts[c_k].empty() && (r.K = batch_k(parts[c_k])) == -1)
+                r.error = "K must be a whole number in 1.." + to_string(MAX_BATCH_K);
+            if(c_id >= 0 && c_id < (int)nf) r.id = parts[c_id];
+            if(c_profile >= 0 && c_profile < (int)nf) r.profile = parts[c_profile];
+        }
+        if(r.id.empty()) r.id = to_string(out.size());
+        out.push_back(r);
     }
+    return true;
+}
 
-    auto routes = k_short_simple(src,tgt,K);
-    if(routes.empty()) { cerr<<"No routes found\n"; return 1; }
+json answer_request(const BatchRequest &r, ThreadPool *spur_pool) {
+    json res;
+    res["id"] = r.id; res["start"] = r.start; res["dest"] = r.dest;
+    if(!r.profile.empty()) res["profile"] = r.profile;
+    if(!r.error.empty()) { res["error"] = r.error; return res; }
+    if(r.src == -1 || r.tgt == -1) { res["error"] = "start or dest node not found"; return res; }
+    const vector<double> *cost = profile_cost(r.profile);
+    if(!cost) { res["error"] = "unknown profile"; return res; }
+    auto routes = k_short_simple(local_workspace(), r.src, r.tgt, r.K, spur_pool, *cost);
+    res["routes"] = json::array();
+    PhaseTimer pt(phase_times.output_ms);
+    for(size_t i=0;i<routes.size();++i) res["routes"].push_back(route_json(routes[i], (int)i, *cost));
+    if(routes.empty()) res["error"] = "no route";
+    return res;
+}
 
-    // print reasons - compare to best
-    vector<vector<int>> allroutes = routes;
-    cout << fixed << setprecision(3);
-    cout << "\nTop " << allroutes.size() << " routes from " << start_name << " -> " << dest_name << ":\n";
-    for(size_t i=0;i<allroutes.size();++i) {
-        double total_m = 0.0;
-        for(size_t z=0; z+1<allroutes[i].size(); ++z){
-            for(auto pr: adj[allroutes[i][z]]){
-                if(pr.first == allroutes[i][z+1]){
-                    total_m += edges[pr.second].distance_m;
-                    break;
-                }
+// requests run on the pool; results are still streamed in input order
+int run_batch(const string &batch_file, const string &out_file, bool simplify, int threads) {
+    vector<BatchRequest> reqs;
+    if(!read_batch(batch_file, reqs)) { cerr << "Cannot read batch " << batch_file << "\n"; return 1; }
+    vector<int> endpoints;
+    for(auto &r: reqs){
+        if(r.error.empty()) { r.src = resolve_node(r.start); r.tgt = resolve_node(r.dest); }
+        endpoints.push_back(r.src); endpoints.push_back(r.tgt);
+        if(Profile *p = find_profile(r.profile)) p->in_use = true;
+    }
+    prepare_graph(endpoints, simplify);
+    ofstream fo;
+    if(!out_file.empty()) { fo.open(out_file); if(!fo) { cerr << "Cannot write " << out_file << "\n"; return 1; } }
+    ostream &os = out_file.empty() ? cout : fo;
+    auto t0 = stat_clock::now();
+    size_t answered = 0, failed = 0, nroutes = 0;
+    vector<json> results(reqs.size());
+    vector<char> ready(reqs.size(), 0);
+    mutex mu; condition_variable cv;
+    ThreadPool *pool = threads > 1 ? engine_pool : nullptr;
+    // enough requests to keep every thread busy: don't split single queries further
+    ThreadPool *spur_pool = pool && reqs.size() < pool->size() ? pool : nullptr;
+    thread feeder;
+    auto solve_all = [&]{
+        pool_for(pool, reqs.size(), [&](size_t i){
+            json res = answer_request(reqs[i], spur_pool);
+            lock_guard<mutex> lk(mu);
+            results[i] = move(res); ready[i] = 1;
+            cv.notify_all();
+        });
+    };
+    if(pool) feeder = thread(solve_all); else solve_all();
+    for(size_t i=0;i<reqs.size();++i){
+        json res;
+        {
+            unique_lock<mutex> lk(mu);
+            cv.wait(lk, [&]{ return ready[i] != 0; });
+            res = move(results[i]);
+        }
+        if(res.contains("error")) failed++; else answered++;
+        if(res.contains("routes")) nroutes += res["routes"].size();
+        os << res.dump() << "\n";
+    }
+    if(feeder.joinable()) feeder.join();
+    os.flush();
+    double ms = chrono::duration<double, milli>(stat_clock::now() - t0).count();
+    cerr << fixed << setprecision(1) << "batch: " << reqs.size() << " requests (" << answered << " answered, " << failed
+         << " failed, " << nroutes << " routes) in " << ms << " ms, " << (ms > 0 ? 1000.0 * reqs.size() / ms : 0.0) << " req/s on "
+         << max(1, threads) << " thread(s)\n";
+    return 0;
+}
+
+// distance matrices for dispatch (e.g. all units x all incidents). Entries are
+// the composite cost of the best route, +inf when unreachable.
+// "search" mode runs one forward search per source that stops once every
+// target is settled; "buckets" mode answers the whole matrix from a
+// contraction hierarchy with one upward search per source and per target.
+struct MatrixTargets {
+    vector<int> slot;         // node -> distinct target index, -1 if not a target
+    vector<int> node;         // distinct target -> node
+    vector<vector<int>> cols; // distinct target -> matrix columns
+};
+
+MatrixTargets matrix_targets(const vector<int> &tgts) {
+    MatrixTargets mt;
+    mt.slot.assign(adj.size(), -1);
+    for(size_t j=0;j<tgts.size();++j){
+        int t = tgts[j];
+        if(t < 0) continue;
+        if(mt.slot[t] == -1) { mt.slot[t] = (int)mt.node.size(); mt.node.push_back(t); mt.cols.emplace_back(); }
+        mt.cols[mt.slot[t]].push_back((int)j);
+    }
+    return mt;
+}
+
+void one_to_many(SearchWorkspace &ws, int src, const MatrixTargets &mt, double *row) {
+    TraceScope ts("one_to_many");
+    size_t left = 0;
+    for(int t : mt.node) if(maybe_reachable(src, t)) left++;
+    if(!left) return;
+    ws.prepare(adj.size(), sedges.size());
+    auto &hp = ws.heap[0];
+    auto cmp = greater<pair<double,int>>();
+    ws.set(0, src, 0.0, -1); hp.push_back({0.0, src});
+    uint64_t settled = 0, relaxed = 0, pushes = 1, pops = 0;
+    while(!hp.empty() && left){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        auto pr = hp.back(); hp.pop_back(); pops++;
+        double d = pr.first; int u = pr.second;
+        if(d > ws.d(0, u)) continue;
+        settled++;
+        int k = mt.slot[u];
+        if(k != -1) { for(int c : mt.cols[k]) row[c] = d; left--; }
+        for(auto &a: adj[u]){
+            double c = sedge_cost[a.ei];
+            if(c >= 1e6) continue; // blocked
+            relaxed++;
+            double nd = d + c;
+            if(nd + 1e-9 < ws.d(0, a.to)) {
+                ws.set(0, a.to, nd, u);
+                hp.push_back({nd, a.to}); push_heap(hp.begin(), hp.end(), cmp); pushes++;
             }
         }
-        cout << i+1 << ") Distance = " << (total_m/1000.0) << " km | Hops = " << (allroutes[i].size()-1) << " | Path: ";
-        for(size_t k=0;k<allroutes[i].size();++k){
-            cout << nodes[allroutes[i][k]].name;
-            if(k+1<allroutes[i].size()) cout << " -> ";
-        }
-        cout << "\n";
-        if(i>0) {
-            // simple reasoning
-            double best_m = 0.0;
-            for(size_t z=0; z+1<allroutes[0].size(); ++z){
-                for(auto pr: adj[allroutes[0][z]]){
-                    if(pr.first == allroutes[0][z+1]){
-                        best_m += edges[pr.second].distance_m; break;
-                    }
-                }
+    }
+    if(collect_stats) add_search_stats(settled, relaxed, pushes, pops);
+    if(ts.on) ts.args = "{\"settled\":" + to_string(settled) + "}";
+}
+
+// Contract nodes cheapest-first by (shortcuts added - arcs removed + contracted
+// neighbours), lazily re-evaluating the popped node. A shortcut u->w replaces
+// u->v->w unless a bounded witness search finds a path no costlier around v.
+// Blocked search edges are left out; rebuild after compile_costs changes costs.
+// Given an order (nodes, lowest rank first) only the shortcuts are recomputed,
+// which is the cheap way to re-customize after an updates snapshot.
+void build_ch(const vector<int> &order = {}) {
+    TraceScope ts("build_ch");
+    const double INF = SearchWorkspace::INF;
+    int n = adj.size();
+    vector<vector<CHArc>> out(n), in(n);
+    auto add_arc = [](vector<CHArc> &l, int to, double w){
+        for(auto &a: l) if(a.to == to) { a.w = min(a.w, w); return; }
+        l.push_back({to, w});
+    };
+    for(int u=0;u<n;++u) for(auto &a: adj[u]){
+        double c = sedge_cost[a.ei];
+        if(c >= 1e6 || a.to == u) continue;
+        add_arc(out[u], a.to, c); add_arc(in[a.to], u, c);
+    }
+    vector<double> wd(n, INF);
+    vector<uint32_t> wstamp(n, 0);
+    uint32_t wep = 0;
+    vector<pair<double,int>> wh;
+    auto cmp = greater<pair<double,int>>();
+    auto wdist = [&](int x){ return wstamp[x] == wep ? wd[x] : INF; };
+    // cheapest paths from u that avoid v, up to limit or max_settle settled nodes
+    auto witness = [&](int u, int v, double limit, int max_settle){
+        if(++wep == 0) { fill(wstamp.begin(), wstamp.end(), 0); wep = 1; }
+        wh.clear();
+        wstamp[u] = wep; wd[u] = 0.0; wh.push_back({0.0, u});
+        int settled = 0;
+        while(!wh.empty()){
+            pop_heap(wh.begin(), wh.end(), cmp);
+            auto pr = wh.back(); wh.pop_back();
+            if(pr.first > wdist(pr.second)) continue;
+            if(pr.first > limit || ++settled > max_settle) break;
+            for(auto &a: out[pr.second]){
+                if(a.to == v) continue;
+                double nd = pr.first + a.w;
+                if(nd < wdist(a.to)) { wstamp[a.to] = wep; wd[a.to] = nd; wh.push_back({nd, a.to}); push_heap(wh.begin(), wh.end(), cmp); }
             }
-            double diff_km = (total_m - best_m) / 1000.0;
-            cout << "  -> Why not preferred: Longer than best by " << diff_km << " km.";
-            if(allroutes[i].size() > allroutes[0].size()) cout << " More hops (" << (allroutes[i].size()-1) << " vs " << (allroutes[0].size()-1) << ").";
-            cout << "\n";
-        } else {
-            cout << "  -> Chosen as BEST route (composite score).\n";
         }
+    };
+    struct Shortcut { int u, w; double c; };
+    vector<Shortcut> pending;
+    auto shortcuts_for = [&](int v, int max_settle, bool keep){
+        int added = 0;
+        double max_out = 0.0;
+        for(auto &b: out[v]) max_out = max(max_out, b.w);
+        for(auto &a: in[v]){
+            witness(a.to, v, a.w + max_out, max_settle);
+            for(auto &b: out[v]){
+                if(b.to == a.to || wdist(b.to) <= a.w + b.w) continue;
+                added++;
+                if(keep) pending.push_back({a.to, b.to, a.w + b.w});
+            }
+        }
+        return added;
+    };
+    vector<int> gone_nbrs(n, 0), level(n, 0);
+    auto priority = [&](int v){
+        return 2*shortcuts_for(v, 50, false) - (int)(in[v].size() + out[v].size()) + gone_nbrs[v] + level[v];
+    };
+    bool fixed = (int)order.size() == n;
+    ch = ContractionHierarchy();
+    ch.rank.assign(n, -1);
+    priority_queue<pair<int,int>, vector<pair<int,int>>, greater<pair<int,int>>> pq;
+    if(!fixed) for(int v=0;v<n;++v) pq.push({priority(v), v});
+    int next_rank = 0;
+    auto drop = [](vector<CHArc> &l, int x){
+        for(size_t k=0;k<l.size();++k) if(l[k].to == x) { l[k] = l.back(); l.pop_back(); return; }
+    };
+    while(fixed ? next_rank < n : !pq.empty()){
+        int v;
+        if(fixed) v = order[next_rank];
+        else {
+            v = pq.top().second; pq.pop();
+            if(ch.rank[v] != -1) continue;
+            int p = priority(v);
+            if(!pq.empty() && p > pq.top().first) { pq.push({p, v}); continue; }
+        }
+        pending.clear();
+        shortcuts_for(v, 1000, true);
+        ch.rank[v] = next_rank++;
+        // v's remaining arcs all lead to higher ranks: they become its up/down arcs as they stand
+        for(auto &a: in[v]) { drop(out[a.to], v); gone_nbrs[a.to]++; level[a.to] = max(level[a.to], level[v]+1); }
+        for(auto &b: out[v]) { drop(in[b.to], v); gone_nbrs[b.to]++; level[b.to] = max(level[b.to], level[v]+1); }
+        for(auto &s: pending) {
+            size_t before = out[s.u].size();
+            add_arc(out[s.u], s.w, s.c); add_arc(in[s.w], s.u, s.c);
+            if(out[s.u].size() > before) ch.shortcuts++;
+        }
+    }
+    auto flatten = [n](const vector<vector<CHArc>> &l, vector<int> &off, vector<CHArc> &arcs){
+        off.assign(n+1, 0);
+        for(int v=0;v<n;++v) off[v+1] = off[v] + (int)l[v].size();
+        arcs.clear(); arcs.reserve(off[n]);
+        for(int v=0;v<n;++v) arcs.insert(arcs.end(), l[v].begin(), l[v].end());
+    };
+    flatten(out, ch.up_off, ch.up);
+    flatten(in, ch.down_off, ch.down);
+    ch.sweep_node.resize(n);
+    for(int v=0;v<n;++v) ch.sweep_node[n-1-ch.rank[v]] = v;
+    ch.sweep_off.assign(n+1, 0);
+    ch.sweep_in.clear(); ch.sweep_in.reserve(ch.down.size());
+    for(int i=0;i<n;++i){
+        int v = ch.sweep_node[i];
+        for(int k=ch.down_off[v];k<ch.down_off[v+1];++k) ch.sweep_in.push_back({n-1-ch.rank[ch.down[k].to], ch.down[k].w});
+        ch.sweep_off[i+1] = (int)ch.sweep_in.size();
     }
+    if(ts.on) ts.args = "{\"shortcuts\":" + to_string(ch.shortcuts) + "}";
+}
 
-    // write path.json for viewer
-    write_path_json(allroutes, "path.json");
-    cout << "Wrote path.json\n";
-    return 0;
+// upward search from s (forward over up arcs, or backward over down arcs when
+// !forward) with stall-on-demand; reached gets every non-stalled settled node
+void ch_upward(SearchWorkspace &ws, int s, bool forward, vector<pair<int,double>> &reached) {
+    const vector<int> &off = forward ? ch.up_off : ch.down_off, &soff = forward ? ch.down_off : ch.up_off;
+    const vector<CHArc> &arcs = forward ? ch.up : ch.down, &sarcs = forward ? ch.down : ch.up;
+    ws.prepare(adj.size(), sedges.size());
+    auto &hp = ws.heap[0];
+    auto cmp = greater<pair<double,int>>();
+    ws.set(0, s, 0.0, -1); hp.push_back({0.0, s});
+    uint64_t settled = 0, relaxed = 0, pushes = 1, pops = 0;
+    reached.clear();
+    while(!hp.empty()){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        auto pr = hp.back(); hp.pop_back(); pops++;
+        double d = pr.first; int u = pr.second;
+        if(d > ws.d(0, u)) continue;
+        settled++;
+        bool stalled = false;
+        for(int k=soff[u];k<soff[u+1] && !stalled;++k) stalled = ws.d(0, sarcs[k].to) + sarcs[k].w < d;
+        if(stalled) continue;
+        reached.push_back({u, d});
+        for(int k=off[u];k<off[u+1];++k){
+            relaxed++;
+            double nd = d + arcs[k].w;
+            if(nd < ws.d(0, arcs[k].to)) {
+                ws.set(0, arcs[k].to, nd, u);
+                hp.push_back({nd, arcs[k].to}); push_heap(hp.begin(), hp.end(), cmp); pushes++;
+            }
+        }
+    }
+    if(collect_stats) add_search_stats(settled, relaxed, pushes, pops);
+}
+
+// backward upward searches from every target fill per-node buckets of
+// (column, cost); each source's upward search then scans the buckets it meets
+void many_to_many_buckets(const vector<int> &srcs, const vector<int> &tgts, vector<double> &m, ThreadPool *pool) {
+    TraceScope ts("many_to_many_buckets");
+    size_t T = tgts.size();
+    vector<vector<pair<int,double>>> back(T);
+    pool_for(pool, T, [&](size_t j){ if(tgts[j] >= 0) ch_upward(local_workspace(), tgts[j], false, back[j]); });
+    int n = adj.size();
+    vector<int> boff(n+1, 0);
+    for(auto &b: back) for(auto &pr: b) boff[pr.first+1]++;
+    for(int v=0;v<n;++v) boff[v+1] += boff[v];
+    struct Entry { int col; double d; };
+    vector<Entry> bucket(boff[n]);
+    {
+        vector<int> cur(boff.begin(), boff.end()-1);
+        for(size_t j=0;j<T;++j) for(auto &pr: back[j]) bucket[cur[pr.first]++] = {(int)j, pr.second};
+    }
+    back.clear(); back.shrink_to_fit();
+    pool_for(pool, srcs.size(), [&](size_t i){
+        if(srcs[i] < 0) return;
+        vector<pair<int,double>> fwd;
+        ch_upward(local_workspace(), srcs[i], true, fwd);
+        double *row = &m[i*T];
+        for(auto &pr: fwd)
+            for(int k=boff[pr.first];k<boff[pr.first+1];++k)
+                row[bucket[k].col] = min(row[bucket[k].col], pr.second + bucket[k].d);
+    });
+}
+
+// one node (name or id) per line
+bool read_node_list(const string &path, vector<string> &out) {
+    ifstream f(path);
+    if(!f) return false;
+    string line;
+    while(getline(f,line)){
+        if(!line.empty() && line.back() == '\r') line.pop_back();
+        if(!line.empty()) out.push_back(line);
+    }
+    return true;
+}
+
+// CSV: header "source,<targets>", one row per source, "inf" when unreachable.
+// Binary (.bin): "SPMX", uint32 rows, uint32 cols, then rows*cols float64 row-major.
+bool write_matrix(const string &outfn, const vector<string> &src_names, const vector<string> &tgt_names, const vector<double> &m) {
+    size_t R = src_names.size(), C = tgt_names.size();
+    bool bin = outfn.size() >= 4 && outfn.compare(outfn.size()-4, 4, ".bin") == 0;
+    if(bin) {
+        FILE *f = fopen(outfn.c_str(), "wb");
+        if(!f) return false;
+        uint32_t hdr[2] = {(uint32_t)R, (uint32_t)C};
+        fwrite("SPMX", 1, 4, f); fwrite(hdr, sizeof(uint32_t), 2, f);
+        fwrite(m.data(), sizeof(double), m.size(), f);
+        return fclose(f) == 0;
+    }
+    ofstream fo(outfn);
+    if(!fo) return false;
+    fo << fixed << setprecision(3) << "source";
+    for(auto &t: tgt_names) fo << "," << t;
+    fo << "\n";
+    for(size_t i=0;i<R;++i){
+        fo << src_names[i];
+        for(size_t j=0;j<C;++j){
+            double v = m[i*C+j];
+            if(isinf(v)) fo << ",inf"; else fo << "," << v;
+        }
+        fo << "\n";
+    }
+    return (bool)fo;
+}
+
+// PHAST one-to-all: upward search from src, then a single pass over the nodes
+// in descending rank pulling each distance through its down arcs. dist is
+// indexed by node, +inf where unreachable. Needs build_ch().
+void phast(SearchWorkspace &ws, int src, vector<double> &dist) {
+    TraceScope ts("phast");
+    const double inf = numeric_limits<double>::infinity();
+    int n = ch.sweep_node.size();
+    thread_local vector<pair<int,double>> reached;
+    thread_local vector<double> dd;
+    ch_upward(ws, src, true, reached);
+    dd.assign(n, inf);
+    for(auto &pr: reached) dd[n-1-ch.rank[pr.first]] = pr.second;
+    const CHArc *in = ch.sweep_in.data();
+    for(int i=0;i<n;++i){
+        double best = dd[i];
+        for(int k=ch.sweep_off[i];k<ch.sweep_off[i+1];++k) best = min(best, dd[in[k].to] + in[k].w);
+        dd[i] = best;
+    }
+    dist.resize(n);
+    for(int i=0;i<n;++i) dist[ch.sweep_node[i]] = dd[i];
+}
+
+// CSV "id,name,cost" per node ("inf" when unreachable); .bin is a 1 x n SPMX matrix
+bool write_distances(const string &outfn, const string &src_name, const vector<double> &dist) {
+    if(outfn.size() >= 4 && outfn.compare(outfn.size()-4, 4, ".bin") == 0)
+        return write_matrix(outfn, {src_name}, vector<string>(dist.size()), dist);
+    ofstream fo(outfn);
+    if(!fo) return false;
+    fo << fixed << setprecision(3) << "id,name,cost\n";
+    for(size_t v=0;v<dist.size();++v){
+        fo << v << ",\"" << node_name(v) << "\",";
+        if(isinf(dist[v])) fo << "inf\n"; else fo << dist[v] << "\n";
+    }
+    return (bool)fo;
+}
+
+// distances from start to every node, once for the loaded updates and once per
+// extra snapshot; phast mode keeps the first contraction order and only
+// recomputes shortcuts for later snapshots
+int run_one_to_all(const string &start, const string &out_file, const string &mode, const vector<string> &snapshots) {
+    int src = resolve_node(start);
+    if(src == -1) { cerr << "Start node not found: " << start << "\n"; return 1; }
+    prepare_graph({src}, false);
+    vector<int> order;
+    for(size_t k=0;k<=snapshots.size();++k){
+        if(k > 0) {
+            if(!load_updates(snapshots[k-1])) { cerr << "Cannot load updates " << snapshots[k-1] << "\n"; return 1; }
+            PhaseTimer pt(phase_times.compile_ms);
+            compile_costs();
+        }
+        auto t0 = stat_clock::now();
+        if(mode == "phast") {
+            PhaseTimer pt(phase_times.compile_ms);
+            build_ch(order);
+            if(order.empty()) { order.resize(ch.rank.size()); for(size_t v=0;v<ch.rank.size();++v) order[ch.rank[v]] = v; }
+        }
+        double prep_ms = chrono::duration<double, milli>(stat_clock::now() - t0).count();
+        t0 = stat_clock::now();
+        vector<double> dist;
+        {
+            PhaseTimer pt(phase_times.search_ms);
+            if(mode == "phast") phast(local_workspace(), src, dist);
+            else {
+                vector<int> all(adj.size());
+                iota(all.begin(), all.end(), 0);
+                dist.assign(adj.size(), numeric_limits<double>::infinity());
+                one_to_many(local_workspace(), src, matrix_targets(all), dist.data());
+            }
+        }
+        double ms = chrono::duration<double, milli>(stat_clock::now() - t0).count();
+        string fn = out_file;
+        if(k > 0) { size_t dot = fn.rfind('.'); fn.insert(dot == string::npos ? fn.size() : dot, "." + to_string(k)); }
+        if(!write_distances(fn, string(node_name(src)), dist)) { cerr << "Cannot write " << fn << "\n"; return 1; }
+        size_t reached = count_if(dist.begin(), dist.end(), [](double d){ return !isinf(d); });
+        cerr << fixed << setprecision(1) << "one-to-all (" << mode << "): " << reached << " of " << dist.size() << " nodes reached in "
+             << ms << " ms";
+        if(mode == "phast") cerr << " after " << prep_ms << " ms " << (k ? "re-customizing" : "building") << " the hierarchy";
+        cerr << ", wrote " << fn << "\n";
+    }
+    return 0;
+}
+
+int run_matrix(const string &sources_file, const string &targets_file, const string &out_file, const string &mode, bool simplify) {
+    vector<string> src_names, tgt_names;
+    if(!read_node_list(sources_file, src_names)) { cerr << "Cannot read " << sources_file << "\n"; return 1; }
+    if(!read_node_list(targets_file, tgt_names)) { cerr << "Cannot read " << targets_file << "\n"; return 1; }
+    vector<int> srcs, tgts, endpoints;
+    for(auto &q: src_names) { srcs.push_back(resolve_node(q)); if(srcs.back() < 0) cerr << "matrix: source not found: " << q << "\n"; }
+    for(auto &q: tgt_names) { tgts.push_back(resolve_node(q)); if(tgts.back() < 0) cerr << "matrix: target not found: " << q << "\n"; }
+    endpoints = srcs; endpoints.insert(endpoints.end(), tgts.begin(), tgts.end());
+    prepare_graph(endpoints, simplify);
+    if(mode == "buckets") {
+        PhaseTimer pt(phase_times.compile_ms);
+        build_ch();
+        cerr << "matrix: contraction hierarchy with " << ch.shortcuts << " shortcuts\n";
+    }
+    auto t0 = stat_clock::now();
+    vector<double> m(srcs.size() * tgts.size(), numeric_limits<double>::infinity());
+    {
+        PhaseTimer pt(phase_times.matrix_ms);
+        if(mode == "buckets") many_to_many_buckets(srcs, tgts, m, engine_pool);
+        else {
+            MatrixTargets mt = matrix_targets(tgts);
+            size_t C = tgts.size();
+            pool_for(engine_pool, srcs.size(), [&](size_t i){ if(srcs[i] >= 0) one_to_many(local_workspace(), srcs[i], mt, &m[i*C]); });
+        }
+    }
+    double ms = chrono::duration<double, milli>(stat_clock::now() - t0).count();
+    if(!write_matrix(out_file, src_names, tgt_names, m)) { cerr << "Cannot write " << out_file << "\n"; return 1; }
+    cerr << fixed << setprecision(1) << "matrix: " << srcs.size() << "x" << tgts.size() << " (" << mode << ") in " << ms
+         << " ms, wrote " << out_file << "\n";
+    return 0;
+}
+
+// nearest facilities: one search from the incident instead of one per facility.
+// Outbound (incident -> facility) searches forward over adj; inbound (facility
+// -> incident, e.g. ambulance dispatch) searches backward over rev_adj(), so
+// prev already points along the facility's route. Stops once k are settled.
+struct FacilityHit { int node; double cost; vector<int> route; };
+
+vector<FacilityHit> nearest_facilities(SearchWorkspace &ws, int src, const vector<char> &is_facility, int k, bool inbound) {
+    TraceScope ts("nearest_facilities");
+    const CSR &g = inbound ? rev_adj() : adj;
+    ws.prepare(adj.size(), sedges.size());
+    auto &hp = ws.heap[0];
+    auto cmp = greater<pair<double,int>>();
+    ws.set(0, src, 0.0, -1); hp.push_back({0.0, src});
+    vector<FacilityHit> hits;
+    uint64_t settled = 0, relaxed = 0, pushes = 1, pops = 0;
+    while(!hp.empty() && (int)hits.size() < k){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        auto pr = hp.back(); hp.pop_back(); pops++;
+        double d = pr.first; int u = pr.second;
+        if(d > ws.d(0, u)) continue;
+        settled++;
+        if(is_facility[u]) {
+            FacilityHit h{u, d, {}};
+            for(int cur = u; cur != -1; cur = ws.pre(0, cur)) h.route.push_back(cur);
+            if(!inbound) reverse(h.route.begin(), h.route.end());
+            hits.push_back(move(h));
+        }
+        for(auto &a: g[u]){
+            double c = sedge_cost[a.ei];
+            if(c >= 1e6) continue; // blocked
+            relaxed++;
+            double nd = d + c;
+            if(nd + 1e-9 < ws.d(0, a.to)) {
+                ws.set(0, a.to, nd, u);
+                hp.push_back({nd, a.to}); push_heap(hp.begin(), hp.end(), cmp); pushes++;
+            }
+        }
+    }
+    if(collect_stats) add_search_stats(settled, relaxed, pushes, pops);
+    if(ts.on) ts.args = "{\"settled\":" + to_string(settled) + ",\"found\":" + to_string(hits.size()) + "}";
+    return hits;
+}
+
+int run_nearest(const string &tag_query, const string &incident, int k, bool inbound, bool simplify) {
+    string tag = tag_query;
+    transform(tag.begin(), tag.end(), tag.begin(), ::tolower);
+    auto it = tagged_nodes.find(tag);
+    if(it == tagged_nodes.end() || it->second.empty()) { cerr << "No nodes tagged \"" << tag_query << "\" (5th nodes.csv column)\n"; return 1; }
+    int src = resolve_node(incident);
+    if(src == -1) { cerr << "Incident node not found: " << incident << "\n"; return 1; }
+    vector<char> is_facility(adj.size(), 0);
+    vector<int> endpoints = it->second;
+    endpoints.push_back(src);
+    for(int v : it->second) if(v >= 0 && v < (int)adj.size()) is_facility[v] = 1;
+    prepare_graph(endpoints, simplify);
+    vector<FacilityHit> hits;
+    { PhaseTimer pt(phase_times.search_ms); hits = nearest_facilities(local_workspace(), src, is_facility, k, inbound); }
+    if(hits.empty()) { cerr << "No reachable node tagged \"" << tag_query << "\"\n"; return 1; }
+    vector<vector<int>> routes;
+    cout << fixed << setprecision(3);
+    cout << "\nNearest " << hits.size() << " of " << it->second.size() << " \"" << tag_query << "\" " << (inbound ? "to " : "from ")
+         << incident << ":\n";
+    for(size_t i=0;i<hits.size();++i){
+        cout << i+1 << ") " << node_name(hits[i].node) << " | Cost = " << hits[i].cost << " | Distance = "
+             << route_distance(hits[i].route)/1000.0 << " km | Hops = " << expand_route(hits[i].route).size()-1 << "\n";
+        routes.push_back(hits[i].route);
+    }
+    write_path_json(routes, "path.json");
+    return 0;
+}
+
+// isochrone: everything reachable from src within budget, by travel time
+// (sedge_time) or composite cost. One bounded search; afterwards each arc out
+// of a reached node is walked edge by edge so nodes inside contracted chains
+// count too, and the point where the budget runs out is interpolated as a
+// frontier point. A chain with a blocked member is walked up to that member. The boundary is the convex hull of reached + frontier points.
+struct Isochrone {
+    vector<pair<int,double>> reached;     // (node, time or cost from src)
+    vector<pair<double,double>> frontier; // (lat, lon) where the budget runs out mid-edge
+    vector<pair<double,double>> polygon;  // convex hull, (lat, lon), counter-clockwise
+};
+
+vector<pair<double,double>> convex_hull(vector<pair<double,double>> pts) {
+    sort(pts.begin(), pts.end());
+    pts.erase(unique(pts.begin(), pts.end()), pts.end());
+    if(pts.size() < 3) return pts;
+    auto cross = [](const pair<double,double> &o, const pair<double,double> &a, const pair<double,double> &b){
+        return (a.second-o.second)*(b.first-o.first) - (a.first-o.first)*(b.second-o.second); // lon as x, lat as y
+    };
+    vector<pair<double,double>> h(2*pts.size());
+    size_t k = 0;
+    for(size_t i=0;i<pts.size();++i){
+        while(k >= 2 && cross(h[k-2], h[k-1], pts[i]) <= 0) k--;
+        h[k++] = pts[i];
+    }
+    for(size_t i=pts.size()-1, lo=k+1; i-- > 0; ){
+        while(k >= lo && cross(h[k-2], h[k-1], pts[i]) <= 0) k--;
+        h[k++] = pts[i];
+    }
+    h.resize(k-1);
+    return h;
+}
+
+Isochrone isochrone(SearchWorkspace &ws, int src, double budget, bool by_time) {
+    TraceScope ts("isochrone");
+    const vector<double> &w = by_time ? sedge_time : sedge_cost;
+    ws.prepare(adj.size(), sedges.size());
+    auto &hp = ws.heap[0];
+    auto cmp = greater<pair<double,int>>();
+    ws.set(0, src, 0.0, -1); hp.push_back({0.0, src});
+    Isochrone iso;
+    uint64_t settled = 0, relaxed = 0, pushes = 1, pops = 0;
+    while(!hp.empty()){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        auto pr = hp.back(); hp.pop_back(); pops++;
+        double d = pr.first; int u = pr.second;
+        if(d > ws.d(0, u)) continue;
+        if(d > budget) break;
+        settled++;
+        iso.reached.push_back({u, d});
+        for(auto &a: adj[u]){
+            if(sedge_cost[a.ei] >= 1e6) continue; // blocked
+            relaxed++;
+            double nd = d + w[a.ei];
+            if(nd + 1e-9 < ws.d(0, a.to)) {
+                ws.set(0, a.to, nd, u);
+                hp.push_back({nd, a.to}); push_heap(hp.begin(), hp.end(), cmp); pushes++;
+            }
+        }
+    }
+    if(collect_stats) add_search_stats(settled, relaxed, pushes, pops);
+    unordered_map<int,double> inner; // chain nodes reached part-way along a search edge
+    size_t nreached = iso.reached.size();
+    for(size_t r=0;r<nreached;++r){
+        int u = iso.reached[r].first;
+        for(auto &a: adj[u]){
+            int si = a.ei;
+            if(sedge_off[si+1]-sedge_off[si] == 1 && (sedge_cost[si] >= 1e6 || ws.d(0, a.to) <= budget)) continue; // blocked, or both ends inside
+            double acc = iso.reached[r].second;
+            int cur = u;
+            bool fwd = sedges[si].u == cur;
+            for(int k=0, cnt=sedge_off[si+1]-sedge_off[si]; k<cnt; ++k){
+                int m = sedge_members[fwd ? sedge_off[si]+k : sedge_off[si+1]-1-k];
+                const Edge &e = edges[m];
+                int nxt = (e.u == cur) ? e.v : e.u;
+                if(edge_update(e).blocked) break;
+                double c = by_time ? edge_time(m) : edge_cost(m);
+                if(acc + c > budget) {
+                    double f = c > 0 ? (budget - acc) / c : 0.0;
+                    iso.frontier.push_back({nodes[cur].lat + f*(nodes[nxt].lat - nodes[cur].lat), nodes[cur].lon + f*(nodes[nxt].lon - nodes[cur].lon)});
+                    break;
+                }
+                acc += c;
+                cur = nxt;
+                if(k+1 < cnt) { auto it = inner.find(cur); if(it == inner.end() || acc < it->second) inner[cur] = acc; }
+            }
+        }
+    }
+    for(auto &pr: inner) iso.reached.push_back(pr);
+    vector<pair<double,double>> pts = iso.frontier;
+    for(auto &pr: iso.reached) pts.push_back({nodes[pr.first].lat, nodes[pr.first].lon});
+    iso.polygon = convex_hull(move(pts));
+    if(ts.on) ts.args = "{\"settled\":" + to_string(settled) + ",\"reached\":" + to_string(iso.reached.size()) + "}";
+    return iso;
+}
+
+int run_isochrone(const string &start, double budget, bool by_time, bool simplify) {
+    int src = resolve_node(start);
+    if(src == -1) { cerr << "Start node not found: " << start << "\n"; return 1; }
+    prepare_graph({src}, simplify);
+    Isochrone iso;
+    { PhaseTimer pt(phase_times.search_ms); iso = isochrone(local_workspace(), src, budget, by_time); }
+    json j;
+    j["start"] = string(node_name(src));
+    j["metric"] = by_time ? "time_s" : "cost";
+    j["budget"] = budget;
+    {
+        PhaseTimer pt(phase_times.output_ms);
+        j["nodes"] = json::array();
+        for(auto &pr: iso.reached)
+            j["nodes"].push_back({{"name", string(node_name(pr.first))}, {"lat", nodes[pr.first].lat}, {"lon", nodes[pr.first].lon}, {"value", pr.second}});
+        j["polygon"] = json::array();
+        for(auto &p: iso.polygon) j["polygon"].push_back({{"lat", p.first}, {"lon", p.second}});
+    }
+    if(collect_stats) j["stats"] = stats_json();
+    ofstream fo("isochrone.json");
+    if(!fo) { cerr << "Cannot write isochrone.json\n"; return 1; }
+    fo << setw(2) << j;
+    cout << iso.reached.size() << " nodes within " << budget << (by_time ? " s" : " cost") << " of " << start << ", "
+         << iso.frontier.size() << " frontier points, hull of " << iso.polygon.size() << "\n";
+    cout << "Wrote isochrone.json\n";
+    return 0;
+}
+
+// several profiles in one traversal ("fastest and safest side by side"). Every
+// node carries one cost per lane (profile) and every search edge one cost per
+// lane, interleaved so a relaxation is a fixed MAX_LANES-wide loop the compiler
+// vectorizes. A node is queued with the smallest lane value that improved since
+// it was last expanded, and expanding it relaxes just those lanes; each lane is
+// label-correcting, so a node can be expanded more than once. Bidirectional like
+// dijkstra_path: queued keys bound every lane from below, so the search stops
+// once the two smallest keys add up to no less than every lane's best meeting.
+constexpr int MAX_LANES = 4;
+
+struct LaneWorkspace {
+    vector<double> dist[2]; vector<int> prev[2]; // node*MAX_LANES + lane
+    vector<uint32_t> stamp[2]; vector<uint8_t> dirty[2];
+    uint32_t epoch = 0;
+    vector<pair<double,int>> heap[2];
+    void prepare(size_t n) {
+        for(int s=0;s<2;++s) if(stamp[s].size() != n) {
+            dist[s].assign(n*MAX_LANES, 0); prev[s].assign(n*MAX_LANES, -1); stamp[s].assign(n, 0); dirty[s].assign(n, 0); epoch = 0;
+        }
+        if(++epoch == 0) { for(int s=0;s<2;++s) fill(stamp[s].begin(), stamp[s].end(), 0); epoch = 1; }
+        heap[0].clear(); heap[1].clear();
+    }
+    double *d(int s, int v) {
+        if(stamp[s][v] != epoch) {
+            stamp[s][v] = epoch; dirty[s][v] = 0;
+            fill_n(&dist[s][(size_t)v*MAX_LANES], MAX_LANES, SearchWorkspace::INF);
+            fill_n(&prev[s][(size_t)v*MAX_LANES], MAX_LANES, -1);
+        }
+        return &dist[s][(size_t)v*MAX_LANES];
+    }
+};
+
+// cols[l] is lane l's compiled cost column; at most MAX_LANES of them. Lanes are
+// rescaled to lane 0's mean edge cost: keys mix lanes, and a lane on a larger
+// scale would otherwise be expanded far out of its own order and re-expanded.
+// Scaling does not change which path is best within a lane. Blocked edges and
+// unused lanes hold +inf, so relaxing needs no per-lane tests.
+vector<double> interleave_lane_costs(const vector<const vector<double>*> &cols) {
+    vector<double> mean(cols.size(), 0.0);
+    size_t open = 0;
+    for(size_t i=0;i<sedges.size();++i){
+        if((*cols[0])[i] >= 1e6) continue;
+        open++;
+        for(size_t l=0;l<cols.size();++l) mean[l] += (*cols[l])[i];
+    }
+    vector<double> scale(cols.size(), 1.0);
+    for(size_t l=1;l<cols.size();++l) if(open && mean[l] > 0) scale[l] = mean[0] / mean[l];
+    const double inf = numeric_limits<double>::infinity();
+    vector<double> lc(sedges.size() * MAX_LANES, inf);
+    parallel_chunks(sedges.size(), [&](size_t b, size_t e){
+        for(size_t i=b;i<e;++i) for(size_t l=0;l<cols.size();++l) {
+            double c = (*cols[l])[i];
+            lc[i*MAX_LANES+l] = c >= 1e6 ? inf : c * scale[l];
+        }
+    });
+    return lc;
+}
+
+vector<vector<int>> multi_profile_paths(LaneWorkspace &ws, const vector<double> &lane_cost, int lanes, int src, int tgt) {
+    TraceScope ts("multi_profile_paths");
+    const double INF = SearchWorkspace::INF;
+    vector<vector<int>> paths(lanes);
+    if(src == tgt) { for(auto &p: paths) p = {src}; return paths; }
+    if(!maybe_reachable(src, tgt)) return paths;
+    const uint8_t all = (uint8_t)((1u << lanes) - 1);
+    const CSR &radj_ = rev_adj();
+    ws.prepare(adj.size());
+    auto cmp = greater<pair<double,int>>();
+    for(int s=0;s<2;++s){
+        int v = s == 0 ? src : tgt;
+        double *dv = ws.d(s, v);
+        for(int l=0;l<lanes;++l) dv[l] = 0.0;
+        ws.dirty[s][v] = all;
+        ws.heap[s].push_back({0.0, v});
+    }
+    double best[MAX_LANES]; int meet[MAX_LANES];
+    fill_n(best, MAX_LANES, INF); fill_n(meet, MAX_LANES, -1);
+    uint64_t settled = 0, relaxed = 0, pushes = 2, pops = 0;
+    while(!ws.heap[0].empty() && !ws.heap[1].empty()){
+        double worst = 0.0;
+        for(int l=0;l<lanes;++l) worst = max(worst, best[l]);
+        if(ws.heap[0].front().first + ws.heap[1].front().first >= worst) break;
+        int side = ws.heap[0].front().first <= ws.heap[1].front().first ? 0 : 1;
+        auto &hp = ws.heap[side];
+        pop_heap(hp.begin(), hp.end(), cmp);
+        int u = hp.back().second; hp.pop_back(); pops++;
+        uint8_t mask = ws.dirty[side][u];
+        if(!mask) continue; // expanded since this entry was queued
+        ws.dirty[side][u] = 0;
+        settled++;
+        double du[MAX_LANES];
+        copy_n(ws.d(side, u), MAX_LANES, du);
+        for(int l=0;l<MAX_LANES;++l) if(!(mask >> l & 1)) du[l] = INF;
+        const CSR &g = side == 0 ? adj : radj_;
+        for(auto &a: g[u]){
+            const double *c = &lane_cost[(size_t)a.ei*MAX_LANES];
+            double *dv = ws.d(side, a.to);
+            double nd[MAX_LANES];
+            unsigned better = 0;
+            for(int l=0;l<MAX_LANES;++l){
+                nd[l] = du[l] + c[l];
+                bool b = nd[l] + 1e-9 < dv[l];
+                dv[l] = b ? nd[l] : dv[l];
+                better |= (unsigned)b << l;
+            }
+            relaxed++;
+            if(!better) continue;
+            double key = INF;
+            for(int l=0;l<lanes;++l) if(better >> l & 1) { ws.prev[side][(size_t)a.to*MAX_LANES+l] = u; key = min(key, nd[l]); }
+            ws.dirty[side][a.to] |= better;
+            hp.push_back({key, a.to}); push_heap(hp.begin(), hp.end(), cmp); pushes++;
+            const double *other = ws.d(1-side, a.to);
+            for(int l=0;l<lanes;++l) if((better >> l & 1) && nd[l] + other[l] < best[l]) { best[l] = nd[l] + other[l]; meet[l] = a.to; }
+        }
+    }
+    if(collect_stats) add_search_stats(settled, relaxed, pushes, pops);
+    if(ts.on) ts.args = "{\"expanded\":" + to_string(settled) + ",\"lanes\":" + to_string(lanes) + "}";
+    for(int l=0;l<lanes;++l){
+        if(meet[l] == -1) continue;
+        for(int cur = meet[l]; cur != -1; cur = ws.prev[0][(size_t)cur*MAX_LANES+l]) paths[l].push_back(cur);
+        reverse(paths[l].begin(), paths[l].end());
+        for(int cur = ws.prev[1][(size_t)meet[l]*MAX_LANES+l]; cur != -1; cur = ws.prev[1][(size_t)cur*MAX_LANES+l]) paths[l].push_back(cur);
+    }
+    return paths;
+}
+
+int run_multi_profile(const string &start, const string &dest, const vector<string> &names, bool simplify) {
+    if(names.empty() || names.size() > (size_t)MAX_LANES) { cerr << "--compare takes 1 to " << MAX_LANES << " profiles\n"; return 1; }
+    for(auto &nm: names) {
+        Profile *p = find_profile(nm);
+        if(!p) { cerr << "Unknown profile " << nm << "\n"; return 1; }
+        p->in_use = true;
+    }
+    int src = resolve_node(start), tgt = resolve_node(dest);
+    if(src == -1 || tgt == -1) { cerr << "Start or dest node not found\n"; return 1; }
+    prepare_graph({src, tgt}, simplify);
+    vector<const vector<double>*> cols;
+    for(auto &nm: names) cols.push_back(profile_cost(nm));
+    vector<double> lane_cost = interleave_lane_costs(cols);
+    LaneWorkspace ws;
+    vector<vector<int>> paths;
+    { PhaseTimer pt(phase_times.search_ms); paths = multi_profile_paths(ws, lane_cost, (int)names.size(), src, tgt); }
+    json j;
+    j["routes"] = json::array();
+    cout << fixed << setprecision(3) << "\nBest route per profile from " << start << " -> " << dest << ":\n";
+    for(size_t l=0;l<names.size();++l){
+        if(paths[l].empty()) { cout << names[l] << ": no route\n"; continue; }
+        double c = 0.0, t = 0.0;
+        for(size_t z=0; z+1<paths[l].size(); ++z) {
+            int si = arc_between(paths[l][z], paths[l][z+1], *cols[l]);
+            c += (*cols[l])[si]; t += sedge_time[si];
+        }
+        json r = route_json(paths[l], (int)j["routes"].size(), *cols[l]);
+        r["profile"] = names[l];
+        cout << names[l] << ": Cost = " << c << " | Distance = " << route_distance(paths[l], *cols[l])/1000.0 << " km | Time = "
+             << t/60.0 << " min | Hops = " << r["points"].size()-1 << "\n";
+        j["routes"].push_back(r);
+    }
+    if(collect_stats) j["stats"] = stats_json();
+    ofstream fo("path.json");
+    fo << setw(2) << j;
+    cout << "Wrote path.json\n";
+    return 0;
+}
+
+// Pareto routes on (distance m, freeflow time s, safety penalty): every route
+// that no other route beats on all three. Label-setting multi-criteria search:
+// each node keeps a bag of non-dominated labels (cost vectors), and labels are
+// expanded in lexicographic order of cost + lower bound, so a popped label is
+// final. The bounds to tgt come from one backward Dijkstra per criterion. A
+// label is dropped once a route found at tgt covers its cost + bound (target
+// pruning), which is what keeps large graphs tractable. Routes reach tgt in
+// increasing distance, never above the key being tested, so only time and
+// safety need comparing: the found routes are kept as a staircase (time ->
+// smallest safety) and one lookup answers "covered?". With eps > 0 a label
+// within a factor (1+eps) of an existing one counts as covered, so near
+// duplicates collapse and the bags stay small.
+constexpr int PARETO_DIMS = 3;
+struct ParetoLabel { double c[PARETO_DIMS]; int node, pred; bool dead; };
+struct BagEntry { double c[PARETO_DIMS]; int id; }; // costs inline so a bag scan stays in one array
+struct ParetoRoute { vector<int> route; double c[PARETO_DIMS]; };
+
+// b covers a: b is no worse than a*(1+eps) in every criterion
+inline bool pareto_covers(const double *b, const double *a, double eps) {
+    for(int k=0;k<PARETO_DIMS;++k) if(b[k] > a[k]*(1.0+eps) + 1e-9) return false;
+    return true;
+}
+
+// lb[v] = cheapest v -> tgt under one criterion column, INF where unreachable
+void target_bound(int tgt, const vector<double> &col, vector<double> &lb) {
+    const CSR &g = rev_adj();
+    lb.assign(adj.size(), SearchWorkspace::INF);
+    vector<pair<double,int>> hp{{0.0, tgt}};
+    auto cmp = greater<pair<double,int>>();
+    lb[tgt] = 0.0;
+    while(!hp.empty()){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        auto pr = hp.back(); hp.pop_back();
+        if(pr.first > lb[pr.second]) continue;
+        for(auto &a: g[pr.second]){
+            if(cost_terms.blocked[a.ei] != 0.0) continue;
+            double nd = pr.first + col[a.ei];
+            if(nd < lb[a.to]) { lb[a.to] = nd; hp.push_back({nd, a.to}); push_heap(hp.begin(), hp.end(), cmp); }
+        }
+    }
+}
+
+vector<ParetoRoute> pareto_routes(int src, int tgt, double eps) {
+    TraceScope ts("pareto_routes");
+    vector<ParetoRoute> out;
+    if(!maybe_reachable(src, tgt)) return out;
+    const vector<double> *cols[PARETO_DIMS] = {&cost_terms.dist, &cost_terms.time, &cost_terms.safety};
+    vector<double> lb[PARETO_DIMS];
+    pool_for(engine_pool, PARETO_DIMS, [&](size_t k){ target_bound(tgt, *cols[k], lb[k]); });
+    if(lb[0][src] >= SearchWorkspace::INF) return out;
+    vector<ParetoLabel> labels;
+    vector<vector<BagEntry>> bag(adj.size());
+    struct Entry { double k[PARETO_DIMS]; int id; };
+    auto cmp = [](const Entry &a, const Entry &b){ return lexicographical_compare(b.k, b.k+PARETO_DIMS, a.k, a.k+PARETO_DIMS); };
+    vector<Entry> hp;
+    map<double,double> front; // routes settled at tgt: time -> safety, safety falling as time grows
+    auto target_covers = [&](const double *k) {
+        auto it = front.upper_bound(k[1]*(1.0+eps) + 1e-9);
+        return it != front.begin() && prev(it)->second <= k[2]*(1.0+eps) + 1e-9;
+    };
+    uint64_t settled = 0, relaxed = 0, pushes = 0, pops = 0;
+    // add a label for v unless a label at v or a route at tgt covers it;
+    // labels it strictly dominates leave v's bag
+    auto offer = [&](int v, const double *c, int pred) {
+        Entry e;
+        for(int k=0;k<PARETO_DIMS;++k) e.k[k] = c[k] + lb[k][v];
+        auto &b = bag[v];
+        for(auto &x : b) if(pareto_covers(x.c, c, eps)) return;
+        if(target_covers(e.k)) return;
+        size_t w = 0;
+        for(auto &x : b) { if(pareto_covers(c, x.c, 0.0)) labels[x.id].dead = true; else b[w++] = x; }
+        b.resize(w);
+        e.id = (int)labels.size();
+        labels.push_back({{c[0], c[1], c[2]}, v, pred, false});
+        b.push_back({{c[0], c[1], c[2]}, e.id});
+        hp.push_back(e); push_heap(hp.begin(), hp.end(), cmp); pushes++;
+    };
+    const double zero[PARETO_DIMS] = {0.0, 0.0, 0.0};
+    offer(src, zero, -1);
+    while(!hp.empty()){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        Entry e = hp.back(); hp.pop_back(); pops++;
+        if(labels[e.id].dead) continue;
+        int u = labels[e.id].node;
+        if(u == tgt) { // routes end at tgt
+            settled++;
+            const double *c = labels[e.id].c;
+            if(target_covers(c)) { labels[e.id].dead = true; continue; }
+            auto it = front.insert_or_assign(c[1], c[2]).first;
+            for(++it; it != front.end() && it->second >= c[2];) it = front.erase(it);
+            continue;
+        }
+        if(target_covers(e.k)) { labels[e.id].dead = true; continue; } // routes found since it was queued
+        settled++;
+        double cu[PARETO_DIMS];
+        copy_n(labels[e.id].c, PARETO_DIMS, cu);
+        for(auto &a: adj[u]){
+            if(cost_terms.blocked[a.ei] != 0.0 || lb[0][a.to] >= SearchWorkspace::INF) continue;
+            relaxed++;
+            double c[PARETO_DIMS];
+            for(int k=0;k<PARETO_DIMS;++k) c[k] = cu[k] + (*cols[k])[a.ei];
+            offer(a.to, c, e.id);
+        }
+    }
+    if(collect_stats) add_search_stats(settled, relaxed, pushes, pops);
+    for(auto &x : bag[tgt]){
+        int id = x.id;
+        if(labels[id].dead) continue;
+        ParetoRoute r;
+        copy_n(labels[id].c, PARETO_DIMS, r.c);
+        for(int cur = id; cur != -1; cur = labels[cur].pred) r.route.push_back(labels[cur].node);
+        reverse(r.route.begin(), r.route.end());
+        out.push_back(move(r));
+    }
+    sort(out.begin(), out.end(), [](const ParetoRoute &a, const ParetoRoute &b){ return lexicographical_compare(a.c, a.c+PARETO_DIMS, b.c, b.c+PARETO_DIMS); });
+    if(ts.on) ts.args = "{\"labels\":" + to_string(labels.size()) + ",\"routes\":" + to_string(out.size()) + "}";
+    return out;
+}
+
+int run_pareto(const string &start, const string &dest, double eps, bool simplify) {
+    int src = resolve_node(start), tgt = resolve_node(dest);
+    if(src == -1 || tgt == -1) { cerr << "Start or dest node not found\n"; return 1; }
+    prepare_graph({src, tgt}, simplify);
+    vector<ParetoRoute> routes;
+    { PhaseTimer pt(phase_times.search_ms); routes = pareto_routes(src, tgt, eps); }
+    if(routes.empty()) { cerr << "No routes found\n"; return 1; }
+    json j;
+    j["routes"] = json::array();
+    cout << fixed << setprecision(3) << "\n" << routes.size() << " Pareto routes from " << start << " -> " << dest
+         << " (distance, time, safety penalty):\n";
+    for(size_t i=0;i<routes.size();++i){
+        const ParetoRoute &r = routes[i];
+        json rj = route_json(r.route, (int)i);
+        rj["distance_m"] = r.c[0];
+        rj["duration_min"] = (int)round(r.c[1] / 60.0);
+        rj["safety_penalty"] = r.c[2];
+        cout << i+1 << ") Distance = " << r.c[0]/1000.0 << " km | Time = " << r.c[1]/60.0 << " min | Safety penalty = "
+             << r.c[2] << " | Hops = " << rj["points"].size()-1 << "\n";
+        j["routes"].push_back(rj);
+    }
+    if(collect_stats) j["stats"] = stats_json();
+    ofstream fo("path.json");
+    fo << setw(2) << j;
+    cout << "Wrote path.json\n";
+    return 0;
+}
+
+// safest route at most max_slower (a fraction) slower than the fastest, both
+// by freeflow time: minimize safety penalty subject to time <= (1+x) * fastest.
+// LARAC (Lagrangian relaxation): search on safety + lambda*time and move lambda
+// between the best feasible path (within the limit) and the best infeasible one
+// until the relaxed cost stops improving. Every step is one bidirectional
+// dijkstra_search, so a handful of searches replace enumerating K paths and
+// filtering. Each relaxed optimum bounds the true optimum from below. LARAC can
+// stop short of the optimum; close_gap then finishes it exactly (see there).
+// The cost is scaled by 1/(1+lambda) so it stays under the blocked threshold
+// for any lambda; that does not change the best path.
+struct LagrangeCost {
+    const CostTerms *t; double lambda;
+    double operator()(int ei) const { return t->blocked[ei] != 0.0 ? W_BLOCK : (t->safety[ei] + lambda * t->time[ei]) / (1.0 + lambda); }
+};
+
+struct ConstrainedRoute {
+    vector<int> route, fastest;          // route is empty when no path exists
+    double safety = 0, time = 0;         // totals of route
+    double fast_safety = 0, fast_time = 0, limit = 0;
+    double lower_bound = 0;              // no route within limit has a smaller safety penalty
+    double lambda = 0;                   // last multiplier tried
+    int searches = 0;
+    size_t gap_labels = 0;               // labels close_gap created (0 when LARAC was already optimal)
+};
+
+// (safety penalty, freeflow time) along r, taking the cheapest arc per hop under lambda
+pair<double,double> lagrange_totals(const vector<int> &r, double lambda) {
+    LagrangeCost lc{&cost_terms, lambda};
+    double s = 0.0, t = 0.0;
+    for(size_t z=0; z+1<r.size(); ++z){
+        int best = -1;
+        for(auto &a: adj[r[z]]) if(a.to == r[z+1] && (best == -1 || lc(a.ei) < lc(best))) best = a.ei;
+        if(best != -1) { s += cost_terms.safety[best]; t += cost_terms.time[best]; }
+    }
+    return {s, t};
+}
+
+// exact finish after LARAC: labels (safety, time) grown from src in order of
+// their Lagrangian bound safety + lambda*(time - limit) + lb_lambda(v), which
+// no feasible completion can beat. A label is dropped when that bound reaches
+// the best feasible safety, when time + lb_time(v) exceeds the limit, or when
+// a label at the same node is no worse in both; the search ends when the
+// smallest queued bound does. Both lb columns come from backward searches.
+void close_gap(ConstrainedRoute &res, int src, int tgt) {
+    TraceScope ts("close_gap");
+    const double lambda = res.lambda, limit = res.limit;
+    vector<double> lcol(sedges.size()), lb_l, lb_t;
+    for(size_t i=0;i<lcol.size();++i) lcol[i] = cost_terms.safety[i] + lambda * cost_terms.time[i];
+    pool_for(engine_pool, 2, [&](size_t k){ if(k == 0) target_bound(tgt, lcol, lb_l); else target_bound(tgt, cost_terms.time, lb_t); });
+    struct Label { double s, t; int node, pred; bool dead; };
+    struct Item { double s, t; int id; };
+    vector<Label> labels;
+    vector<vector<Item>> bag(adj.size());
+    vector<pair<double,int>> hp;
+    auto cmp = greater<pair<double,int>>();
+    double best = res.safety; int best_id = -1;
+    uint64_t settled = 0, relaxed = 0, pushes = 0, pops = 0;
+    auto offer = [&](int v, double s, double t, int pred) {
+        if(lb_t[v] >= SearchWorkspace::INF || t + lb_t[v] > limit + 1e-9) return;
+        double key = s + lambda * (t - limit) + lb_l[v];
+        if(key >= best - 1e-9) return;
+        auto &b = bag[v];
+        for(auto &x : b) if(x.s <= s + 1e-9 && x.t <= t + 1e-9) return;
+        size_t w = 0;
+        for(auto &x : b) { if(s <= x.s && t <= x.t) labels[x.id].dead = true; else b[w++] = x; }
+        b.resize(w);
+        int id = (int)labels.size();
+        labels.push_back({s, t, v, pred, false});
+        b.push_back({s, t, id});
+        hp.push_back({key, id}); push_heap(hp.begin(), hp.end(), cmp); pushes++;
+    };
+    offer(src, 0.0, 0.0, -1);
+    while(!hp.empty() && hp.front().first < best - 1e-9){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        int id = hp.back().second; hp.pop_back(); pops++;
+        if(labels[id].dead) continue;
+        settled++;
+        Label l = labels[id];
+        if(l.node == tgt) { if(l.s < best) { best = l.s; best_id = id; } continue; }
+        for(auto &a: adj[l.node]){
+            if(cost_terms.blocked[a.ei] != 0.0) continue;
+            relaxed++;
+            offer(a.to, l.s + cost_terms.safety[a.ei], l.t + cost_terms.time[a.ei], id);
+        }
+    }
+    if(collect_stats) add_search_stats(settled, relaxed, pushes, pops);
+    res.gap_labels = labels.size();
+    if(ts.on) ts.args = "{\"labels\":" + to_string(labels.size()) + "}";
+    if(best_id != -1) {
+        res.route.clear();
+        for(int cur = best_id; cur != -1; cur = labels[cur].pred) res.route.push_back(labels[cur].node);
+        reverse(res.route.begin(), res.route.end());
+        res.safety = labels[best_id].s; res.time = labels[best_id].t;
+    }
+    res.lower_bound = res.safety;
+}
+
+ConstrainedRoute safest_within(SearchWorkspace &ws, int src, int tgt, double max_slower) {
+    TraceScope ts("safest_within");
+    ConstrainedRoute res;
+    auto search = [&](double lambda) { res.searches++; return dijkstra_search(ws, src, tgt, {}, LagrangeCost{&cost_terms, lambda}); };
+    // near-pure objectives; the tiny other weight breaks ties
+    vector<int> pr = search(1e6);
+    if(pr.empty()) return res;
+    auto [cr, tr] = lagrange_totals(pr, 1e6);
+    res.fastest = pr; res.fast_safety = cr; res.fast_time = tr;
+    res.limit = tr * (1.0 + max_slower);
+    vector<int> pc = search(1e-6);
+    auto [cs, tcs] = lagrange_totals(pc, 1e-6);
+    res.lower_bound = cs;
+    if(tcs <= res.limit + 1e-9) { res.route = pc; res.safety = cs; res.time = tcs; res.lower_bound = cs; }
+    else {
+        // invariant: pr feasible, pc infeasible and at least as safe
+        for(int it=0; it<64 && cr > cs + 1e-9; ++it){
+            double lambda = res.lambda = (cr - cs) / (tcs - tr);
+            vector<int> p = search(lambda);
+            auto [c, t] = lagrange_totals(p, lambda);
+            double lp = c + lambda * t, lpc = cs + lambda * tcs;
+            res.lower_bound = max(res.lower_bound, lp - lambda * res.limit);
+            if(lp >= lpc - 1e-9 * (1.0 + fabs(lpc))) break; // lambda is optimal, pr is the answer
+            if(t <= res.limit + 1e-9) { pr = p; cr = c; tr = t; }
+            else { pc = p; cs = c; tcs = t; }
+        }
+        res.route = pr; res.safety = cr; res.time = tr;
+        res.lower_bound = min(res.lower_bound, cr);
+        if(cr - res.lower_bound > 1e-9) close_gap(res, src, tgt);
+    }
+    if(ts.on) ts.args = "{\"searches\":" + to_string(res.searches) + "}";
+    return res;
+}
+
+int run_constrained(const string &start, const string &dest, double max_slower_pct, bool simplify) {
+    int src = resolve_node(start), tgt = resolve_node(dest);
+    if(src == -1 || tgt == -1) { cerr << "Start or dest node not found\n"; return 1; }
+    prepare_graph({src, tgt}, simplify);
+    ConstrainedRoute cr;
+    { PhaseTimer pt(phase_times.search_ms); cr = safest_within(local_workspace(), src, tgt, max_slower_pct / 100.0); }
+    if(cr.route.empty()) { cerr << "No routes found\n"; return 1; }
+    json j;
+    j["routes"] = json::array();
+    ostringstream pct;
+    pct << max_slower_pct;
+    json r = route_json(cr.route, 0), f = route_json(cr.fastest, 1);
+    r["label"] = "safest within " + pct.str() + "%"; r["safety_penalty"] = cr.safety;
+    f["label"] = "fastest"; f["safety_penalty"] = cr.fast_safety;
+    cout << fixed << setprecision(3) << "\nSafest route from " << start << " -> " << dest << " at most " << pct.str()
+         << "% slower than the fastest (limit " << cr.limit/60.0 << " min):\n";
+    cout << "1) Time = " << cr.time/60.0 << " min | Safety penalty = " << cr.safety << " | Distance = "
+         << route_distance(cr.route)/1000.0 << " km | Hops = " << r["points"].size()-1 << "\n";
+    cout << "Fastest: Time = " << cr.fast_time/60.0 << " min | Safety penalty = " << cr.fast_safety << " | Distance = "
+         << route_distance(cr.fastest)/1000.0 << " km\n";
+    cout << "Searches = " << cr.searches << " | Gap labels = " << cr.gap_labels << "\n";
+    j["routes"].push_back(r);
+    j["routes"].push_back(f);
+    if(collect_stats) j["stats"] = stats_json();
+    ofstream fo("path.json");
+    fo << setw(2) << j;
+    cout << "Wrote path.json\n";
+    return 0;
+}
+
+// time-dependent traffic: per-edge piecewise-linear multiplier over the day,
+// loaded with --td-profiles file.json keyed by edge_id like updates.json:
+//   {"12": [["07:00", 1.0], ["08:30", 2.4], ["10:00", 1.1]], "13": [[0, 1.0], [64800, 1.8]], ...}
+// Times are seconds of day or "HH:MM[:SS]"; the profile wraps around midnight
+// (last point -> first point of the next day). Only edges listed get points,
+// so memory follows the edges with variation; every other edge keeps its
+// updates.json multiplier. Travel time is freeflow_time_s * multiplier(t) at
+// the moment the edge is entered. Routing is only exact when arriving later
+// never means leaving earlier (FIFO), i.e. each segment's slope times
+// freeflow_time_s is >= -1. Loading enforces that by raising the later point
+// of any segment that drops too fast.
+constexpr double DAY_S = 86400.0;
+struct TrafficProfiles {
+    vector<int> edge;                // original edge index, sorted
+    vector<int> off{0};              // points of edge[i]: pts[off[i] .. off[i+1])
+    vector<pair<float,float>> pts;   // (seconds of day, multiplier), increasing time
+    vector<float> min_mul;           // smallest multiplier of edge[i], for the A* bound
+    int slot(int e) const {
+        auto it = lower_bound(edge.begin(), edge.end(), e);
+        return it != edge.end() && *it == e ? (int)(it - edge.begin()) : -1;
+    }
+    double multiplier(int s, double t) const {
+        const pair<float,float> *b = &pts[off[s]], *e = &pts[off[s+1]];
+        if(e - b == 1) return b->second;
+        double tod = fmod(t, DAY_S);
+        if(tod < 0) tod += DAY_S;
+        const pair<float,float> *hi = upper_bound(b, e, tod, [](double x, const pair<float,float> &p){ return x < p.first; });
+        const pair<float,float> *lo;
+        double t0, t1;
+        if(hi == b) { lo = e-1; t0 = lo->first - DAY_S; t1 = hi->first; }        // before the first point
+        else if(hi == e) { lo = e-1; hi = b; t0 = lo->first; t1 = hi->first + DAY_S; } // after the last
+        else { lo = hi-1; t0 = lo->first; t1 = hi->first; }
+        if(t1 <= t0) return lo->second;
+        return lo->second + (hi->second - lo->second) * (tod - t0) / (t1 - t0);
+    }
+};
+TrafficProfiles td_profiles;
+
+// "HH:MM[:SS]" or plain seconds -> seconds, -1 if malformed
+double parse_clock(const string &s) {
+    int h = 0, m = 0, sec = 0, n = 0, len = (int)s.size();
+    if(sscanf(s.c_str(), "%d:%d:%d%n", &h, &m, &sec, &n) == 3 && n == len) return h * 3600.0 + m * 60.0 + sec;
+    if(sscanf(s.c_str(), "%d:%d%n", &h, &m, &n) == 2 && n == len) return h * 3600.0 + m * 60.0;
+    if(s.find(':') != string::npos) return -1;
+    try { size_t pos; double v = stod(s, &pos); return pos == s.size() ? v : -1; } catch(const exception &) { return -1; }
+}
+
+string format_clock(double t) {
+    long s = lround(t), days = s / (long)DAY_S;
+    s %= (long)DAY_S;
+    char buf[32];
+    snprintf(buf, sizeof buf, "%02ld:%02ld:%02ld", s / 3600, s / 60 % 60, s % 60);
+    return days ? string(buf) + " (+" + to_string(days) + "d)" : string(buf);
+}
+
+bool load_td_profiles(const string &path) {
+    TraceScope ts("load_td_profiles");
+    ifstream f(path);
+    if(!f) return false;
+    json j;
+    try { f >> j; } catch(const exception &) { return false; }
+    if(!j.is_object()) { cerr << "td-profiles: expected an object keyed by edge_id\n"; return false; }
+    unordered_map<int,int> by_id;
+    for(size_t i=0;i<edges.size();++i) by_id.emplace(edges[i].edge_id, (int)i);
+    vector<pair<int, vector<pair<float,float>>>> rows;
+    int repaired = 0;
+    for(auto it = j.begin(); it != j.end(); ++it){
+        auto bad = [&](const char *why){ cerr << "td-profiles: " << it.key() << ": " << it.value().dump() << ": " << why << "\n"; return false; };
+        int eid = 0, used = 0;
+        if(sscanf(it.key().c_str(), "%d%n", &eid, &used) != 1 || used != (int)it.key().size()) return bad("key is not an edge_id");
+        if(!it.value().is_array() || it.value().empty()) return bad("expected [[time, multiplier], ..]");
+        vector<pair<float,float>> p;
+        double last = -1;
+        for(auto &pt : it.value()){
+            if(!pt.is_array() || pt.size() != 2 || !(pt[0].is_string() || pt[0].is_number()) || !pt[1].is_number())
+                return bad("each point must be [HH:MM or seconds, number]");
+            double t = pt[0].is_string() ? parse_clock(pt[0].get<string>()) : pt[0].get<double>();
+            if(t < 0) return bad("bad time");
+            if(t < last) return bad("times go backwards");
+            last = t;
+            p.push_back({(float)fmod(t, DAY_S), (float)max(0.0, pt[1].get<double>())});
+        }
+        auto e = by_id.find(eid);
+        if(e == by_id.end()) continue;
+        sort(p.begin(), p.end());
+        // FIFO: freeflow * (m1 - m0) >= -(t1 - t0) on every segment, including the wrap
+        double ff = edges[e->second].freeflow_time_s;
+        // (raising a point can steepen the segment after it, so sweep until stable)
+        bool fixed = false, changed = true;
+        for(size_t pass=0; changed && ff > 0 && p.size() > 1 && pass<=p.size(); ++pass){
+            changed = false;
+            for(size_t k=0;k<p.size();++k){
+                auto &a = p[k], &b = p[(k+1) % p.size()];
+                double dt = k+1 < p.size() ? b.first - a.first : b.first + DAY_S - a.first;
+                if(ff * (b.second - a.second) < -dt - 1e-6) { b.second = (float)(a.second - dt / ff); fixed = changed = true; }
+            }
+        }
+        repaired += fixed;
+        rows.push_back({e->second, move(p)});
+    }
+    sort(rows.begin(), rows.end(), [](const auto &a, const auto &b){ return a.first < b.first; });
+    TrafficProfiles &tp = td_profiles;
+    tp = TrafficProfiles();
+    for(auto &r : rows){
+        if(!tp.edge.empty() && tp.edge.back() == r.first) continue; // duplicate edge_id
+        tp.edge.push_back(r.first);
+        float mn = r.second[0].second;
+        for(auto &p : r.second) { tp.pts.push_back(p); mn = min(mn, p.second); }
+        tp.off.push_back((int)tp.pts.size());
+        tp.min_mul.push_back(mn);
+    }
+    if(repaired) cerr << "td-profiles: " << repaired << " profiles raised to keep FIFO\n";
+    return true;
+}
+
+// nodes as points on a sphere of earth radius (m); the straight-line chord
+// between two of them never exceeds the great-circle distance, satisfies the
+// triangle inequality, and costs no trig per query
+vector<array<double,3>> node_xyz;
+double chord_m(int a, int b) {
+    const auto &p = node_xyz[a], &q = node_xyz[b];
+    return sqrt((p[0]-q[0])*(p[0]-q[0]) + (p[1]-q[1])*(p[1]-q[1]) + (p[2]-q[2])*(p[2]-q[2]));
+}
+
+// arrival time after entering search edge ei at time t: members in order, each
+// priced at the moment it is entered. Constant chains read sedge_time.
+vector<char> sedge_td; // search edge has a profiled member
+double td_arrival(int ei, double t) {
+    if(!sedge_td[ei]) return t + sedge_time[ei];
+    for(int k=sedge_off[ei];k<sedge_off[ei+1];++k){
+        int e = sedge_members[k];
+        int s = td_profiles.slot(e);
+        t += edges[e].freeflow_time_s * (s >= 0 ? td_profiles.multiplier(s, t) : edge_traffic(e));
+    }
+    return t;
+}
+
+// fastest speed any search edge allows (m/s, chord over its least time), so
+// chord / speed never overestimates the remaining time; 0 when some edge is
+// free and the bound is off
+double td_max_speed() {
+    double vmax = 0.0;
+    for(size_t i=0;i<sedges.size();++i){
+        if(cost_terms.blocked[i] != 0.0) continue;
+        double tmin = 0.0;
+        for(int k=sedge_off[i];k<sedge_off[i+1];++k){
+            int e = sedge_members[k];
+            int s = td_profiles.slot(e);
+            tmin += edges[e].freeflow_time_s * (s >= 0 ? td_profiles.min_mul[s] : edge_traffic(e));
+        }
+        double d = chord_m(sedges[i].u, sedges[i].v);
+        if(d <= 0) continue;
+        if(tmin <= 0) return 0.0;
+        vmax = max(vmax, d / tmin);
+    }
+    return vmax;
+}
+
+void prepare_td() {
+    const double R = 6371000.0, rad = M_PI / 180.0;
+    node_xyz.resize(nodes.size());
+    for(size_t i=0;i<nodes.size();++i){
+        double la = nodes[i].lat * rad, lo = nodes[i].lon * rad;
+        node_xyz[i] = {R * cos(la) * cos(lo), R * cos(la) * sin(lo), R * sin(la)};
+    }
+    sedge_td.assign(sedges.size(), 0);
+    for(size_t i=0;i<sedges.size();++i)
+        for(int k=sedge_off[i];k<sedge_off[i+1];++k) if(td_profiles.slot(sedge_members[k]) >= 0) sedge_td[i] = 1;
+}
+
+// earliest arrival at tgt leaving src at depart (seconds, any day). Forward
+// label-setting on arrival time, which FIFO makes exact; with vmax > 0 it is
+// A* on chord(v, tgt) / vmax. Returns the node path, arrival in *arrive.
+vector<int> td_route(SearchWorkspace &ws, int src, int tgt, double depart, double vmax, double *arrive) {
+    TraceScope ts("td_route");
+    *arrive = -1;
+    if(!maybe_reachable(src, tgt)) return {};
+    ws.prepare(adj.size(), sedges.size());
+    auto &hp = ws.heap[0];
+    auto cmp = greater<pair<double,int>>();
+    auto h = [&](int v) { return vmax > 0 ? chord_m(v, tgt) / vmax : 0.0; };
+    ws.set(0, src, depart, -1); hp.push_back({depart + h(src), src});
+    uint64_t settled = 0, relaxed = 0, pushes = 1, pops = 0;
+    bool found = false;
+    while(!hp.empty()){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        int u = hp.back().second; double key = hp.back().first; hp.pop_back(); pops++;
+        double tu = ws.d(0, u);
+        if(key > tu + h(u) + 1e-9) continue;
+        settled++;
+        if(u == tgt) { found = true; break; }
+        for(auto &a: adj[u]){
+            if(cost_terms.blocked[a.ei] != 0.0) continue;
+            relaxed++;
+            double tv = td_arrival(a.ei, tu);
+            if(tv + 1e-9 < ws.d(0, a.to)) {
+                ws.set(0, a.to, tv, u);
+                hp.push_back({tv + h(a.to), a.to}); push_heap(hp.begin(), hp.end(), cmp); pushes++;
+            }
+        }
+    }
+    if(collect_stats) add_search_stats(settled, relaxed, pushes, pops);
+    if(ts.on) ts.args = "{\"settled\":" + to_string(settled) + "}";
+    if(!found) return {};
+    *arrive = ws.d(0, tgt);
+    vector<int> path;
+    for(int cur = tgt; cur != -1; cur = ws.pre(0, cur)) path.push_back(cur);
+    reverse(path.begin(), path.end());
+    return path;
+}
+
+int run_time_dependent(const string &start, const string &dest, double depart, bool use_astar, bool simplify) {
+    int src = resolve_node(start), tgt = resolve_node(dest);
+    if(src == -1 || tgt == -1) { cerr << "Start or dest node not found\n"; return 1; }
+    prepare_graph({src, tgt}, simplify);
+    prepare_td();
+    double vmax = use_astar ? td_max_speed() : 0.0, arrive;
+    vector<int> route;
+    { PhaseTimer pt(phase_times.search_ms); route = td_route(local_workspace(), src, tgt, depart, vmax, &arrive); }
+    if(route.empty()) { cerr << "No routes found\n"; return 1; }
+    json j;
+    j["routes"] = json::array();
+    json r = route_json(route, 0);
+    r["depart"] = format_clock(depart);
+    r["arrive"] = format_clock(arrive);
+    r["duration_min"] = (int)round((arrive - depart) / 60.0);
+    cout << fixed << setprecision(3) << "\nFastest route from " << start << " -> " << dest << " leaving at " << format_clock(depart) << ":\n";
+    cout << "1) Arrive = " << format_clock(arrive) << " | Time = " << (arrive - depart)/60.0 << " min | Distance = "
+         << route_distance(route)/1000.0 << " km | Hops = " << r["points"].size()-1 << "\n";
+    cout << "Profiled edges = " << td_profiles.edge.size() << (vmax > 0 ? " | A* bound" : " | no A* bound") << "\n";
+    j["routes"].push_back(r);
+    if(collect_stats) j["stats"] = stats_json();
+    ofstream fo("path.json");
+    fo << setw(2) << j;
+    cout << "Wrote path.json\n";
+    return 0;
+}
+
+// historical traffic store (--history-build / --history): one multiplier per
+// edge per time slot, e.g. hourly updates.json snapshots over years.
+// Multipliers are quantized to 1/256 and kept in blocks of HISTORY_BLOCK slots.
+// A block opens with every edge's code at its first slot (the checkpoint),
+// then one segment per edge with the deltas to the block's later slots:
+// varint tokens, a zigzag delta or a run of unchanged slots, and trailing
+// unchanged slots are left out. Traffic mostly holds still between slots, so a
+// segment is usually a byte or two. Reading slot t reads one block and replays
+// at most HISTORY_BLOCK-1 deltas per edge; group offsets let groups of
+// HISTORY_GROUP edges decode in parallel. Little-endian, like the .bin matrix:
+//   "SPTH" u32 version, edges, slots, block_slots, group, f32 step
+//   u32 edge_id[edges], u64 block_offset[blocks+1]
+//   block: u16 checkpoint[edges], u32 group_offset[groups], segments (varint byte length + tokens)
+constexpr uint32_t HISTORY_BLOCK = 64, HISTORY_GROUP = 1024;
+constexpr float HISTORY_STEP = 1.0f / 256;
+
+void put_varint(vector<uint8_t> &out, uint64_t v) {
+    while(v >= 0x80) { out.push_back(uint8_t(v) | 0x80); v >>= 7; }
+    out.push_back(uint8_t(v));
+}
+uint64_t get_varint(const uint8_t *&p) {
+    uint64_t v = 0;
+    for(int s=0; ; s+=7) { uint8_t b = *p++; v |= uint64_t(b & 0x7f) << s; if(!(b & 0x80)) return v; }
+}
+
+uint16_t history_code(double mul) { return (uint16_t)min(65535.0, max(0.0, round(mul / HISTORY_STEP))); }
+
+// slot_values(slot, mul) sets mul[e] for every edge index e; called for slots 0, 1, .. in order
+bool write_history(const string &path, uint32_t slots, const function<bool(uint32_t, vector<float>&)> &slot_values, size_t *bytes_out) {
+    TraceScope ts("write_history");
+    ofstream f(path, ios::binary);
+    if(!f) return false;
+    uint32_t n = (uint32_t)edges.size(), blocks = (slots + HISTORY_BLOCK - 1) / HISTORY_BLOCK;
+    uint32_t groups = (n + HISTORY_GROUP - 1) / HISTORY_GROUP;
+    uint32_t head[6] = {1, n, slots, HISTORY_BLOCK, HISTORY_GROUP, 0};
+    float step = HISTORY_STEP;
+    memcpy(&head[5], &step, 4);
+    f.write("SPTH", 4);
+    f.write((const char*)head, sizeof head);
+    for(auto &e : edges) { uint32_t id = (uint32_t)e.edge_id; f.write((const char*)&id, 4); }
+    uint64_t table = f.tellp();
+    vector<uint64_t> block_off(blocks + 1, 0);
+    f.write((const char*)block_off.data(), block_off.size() * 8);
+    vector<float> mul(n);
+    vector<uint16_t> codes;
+    vector<vector<uint8_t>> seg(groups);
+    for(uint32_t b=0;b<blocks;++b){
+        uint32_t len = min(HISTORY_BLOCK, slots - b*HISTORY_BLOCK);
+        codes.assign((size_t)len * n, 0);
+        for(uint32_t s=0;s<len;++s){
+            fill(mul.begin(), mul.end(), 1.0f);
+            if(!slot_values(b*HISTORY_BLOCK + s, mul)) return false;
+            for(uint32_t e=0;e<n;++e) codes[(size_t)s*n + e] = history_code(mul[e]);
+        }
+        parallel_chunks(groups, [&](size_t gb, size_t ge){
+            vector<uint8_t> tok;
+            for(size_t g=gb; g<ge; ++g){
+                seg[g].clear();
+                for(uint32_t e=g*HISTORY_GROUP; e<min(n, (uint32_t)(g+1)*HISTORY_GROUP); ++e){
+                    tok.clear();
+                    uint64_t run = 0;
+                    for(uint32_t s=1;s<len;++s){
+                        int d = (int)codes[(size_t)s*n + e] - (int)codes[(size_t)(s-1)*n + e];
+                        if(d == 0) { run++; continue; }
+                        if(run) { put_varint(tok, run << 1 | 1); run = 0; }
+                        put_varint(tok, (uint64_t)((d << 1) ^ (d >> 31)) << 1);
+                    }
+                    put_varint(seg[g], tok.size());
+                    seg[g].insert(seg[g].end(), tok.begin(), tok.end());
+                }
+            }
+        }, 4);
+        block_off[b] = f.tellp();
+        f.write((const char*)codes.data(), (size_t)n * 2); // slot b*HISTORY_BLOCK is the checkpoint
+        uint32_t off = 0;
+        for(uint32_t g=0;g<groups;++g) { f.write((const char*)&off, 4); off += (uint32_t)seg[g].size(); }
+        for(auto &s : seg) f.write((const char*)s.data(), s.size());
+    }
+    block_off[blocks] = f.tellp();
+    f.seekp(table);
+    f.write((const char*)block_off.data(), block_off.size() * 8);
+    if(bytes_out) *bytes_out = block_off[blocks];
+    return (bool)f;
+}
+
+struct HistoryStore {
+    ifstream f;
+    uint32_t n_edges = 0, n_slots = 0, block_slots = 0, group = 0;
+    float step = 0;
+    vector<uint32_t> edge_id;
+    vector<uint64_t> block_off;
+    vector<uint8_t> buf;
+
+    bool open(const string &path) {
+        f.open(path, ios::binary);
+        char magic[4];
+        uint32_t head[6];
+        if(!f.read(magic, 4) || memcmp(magic, "SPTH", 4) != 0 || !f.read((char*)head, sizeof head) || head[0] != 1) return false;
+        n_edges = head[1]; n_slots = head[2]; block_slots = head[3]; group = head[4];
+        memcpy(&step, &head[5], 4);
+        if(!block_slots || !group) return false;
+        edge_id.resize(n_edges);
+        block_off.resize((n_slots + block_slots - 1) / block_slots + 1);
+        f.read((char*)edge_id.data(), (size_t)n_edges * 4);
+        f.read((char*)block_off.data(), block_off.size() * 8);
+        return (bool)f;
+    }
+    // multipliers of slot t, in the store's edge order
+    bool slice(uint32_t t, vector<float> &mul) {
+        TraceScope ts("history_slice");
+        if(t >= n_slots) return false;
+        uint32_t b = t / block_slots, j = t % block_slots, groups = (n_edges + group - 1) / group;
+        buf.resize(block_off[b+1] - block_off[b]);
+        f.seekg(block_off[b]);
+        if(!f.read((char*)buf.data(), buf.size())) return false;
+        const uint8_t *cp = buf.data(), *gofs = cp + (size_t)n_edges * 2, *data = gofs + (size_t)groups * 4;
+        mul.resize(n_edges);
+        parallel_chunks(groups, [&](size_t gb, size_t ge){
+            for(size_t g=gb; g<ge; ++g){
+                uint32_t off;
+                memcpy(&off, gofs + g*4, 4);
+                const uint8_t *p = data + off;
+                for(uint32_t e=g*group; e<min(n_edges, (uint32_t)(g+1)*group); ++e){
+                    uint16_t c0;
+                    memcpy(&c0, cp + (size_t)e*2, 2);
+                    int code = c0;
+                    uint64_t len = get_varint(p);
+                    const uint8_t *end = p + len;
+                    for(uint32_t rem = j; rem && p < end; ){
+                        uint64_t v = get_varint(p);
+                        if(v & 1) { uint64_t run = v >> 1; rem -= (uint32_t)min<uint64_t>(run, rem); }
+                        else { uint64_t z = v >> 1; code += (int)(z >> 1) ^ -(int)(z & 1); rem--; }
+                    }
+                    p = end;
+                    mul[e] = code * step;
+                }
+            }
+        }, 4);
+        return true;
+    }
+};
+
+// decode one slot of the store into traffic_slice, matched to the loaded edges by edge_id
+bool load_history_slice(const string &path, uint32_t slot) {
+    stat_clock::time_point t0 = stat_clock::now();
+    HistoryStore hs;
+    vector<float> mul;
+    if(!hs.open(path) || !hs.slice(slot, mul)) return false;
+    unordered_map<int,int> by_id;
+    for(size_t i=0;i<edges.size();++i) by_id.emplace(edges[i].edge_id, (int)i);
+    traffic_slice.assign(edges.size(), -1.0f);
+    size_t matched = 0;
+    for(uint32_t e=0;e<hs.n_edges;++e){
+        auto it = by_id.find((int)hs.edge_id[e]);
+        if(it != by_id.end()) { traffic_slice[it->second] = mul[e]; matched++; }
+    }
+    cerr << fixed << setprecision(1) << "history: slot " << slot << " of " << hs.n_slots << ", " << matched << " edges, decoded in "
+         << chrono::duration<double, milli>(stat_clock::now() - t0).count() << " ms\n";
+    return true;
+}
+
+int run_history_build(const string &out_file, const vector<string> &snapshots) {
+    if(snapshots.empty()) { cerr << "--history-build needs --snapshots u0.json,u1.json,.. (one per slot)\n"; return 1; }
+    stat_clock::time_point t0 = stat_clock::now();
+    size_t bytes = 0;
+    bool ok = write_history(out_file, (uint32_t)snapshots.size(), [&](uint32_t s, vector<float> &mul){
+        if(!load_updates(snapshots[s])) { cerr << "Cannot load updates " << snapshots[s] << "\n"; return false; }
+        for(size_t e=0;e<edges.size();++e) mul[e] = (float)edge_update(edges[e]).traffic_mul;
+        return true;
+    }, &bytes);
+    if(!ok) { cerr << "Cannot write " << out_file << "\n"; return 1; }
+    double raw = (double)edges.size() * snapshots.size() * 4;
+    cerr << fixed << setprecision(1) << "history: " << snapshots.size() << " slots x " << edges.size() << " edges, " << bytes
+         << " bytes (" << raw / max<size_t>(bytes, 1) << "x smaller than float32) in "
+         << chrono::duration<double, milli>(stat_clock::now() - t0).count() << " ms, wrote " << out_file << "\n";
+    return 0;
+}
+
+// switch the loaded costs to traffic_slice: only the traffic and time terms
+// depend on it, so this redoes those two columns and the weighting, and keeps
+// the blocked set and components (no updates.json lookups for stored edges)
+void apply_traffic_slice() {
+    TraceScope ts("apply_traffic_slice");
+    parallel_chunks(sedges.size(), [&](size_t b, size_t e){
+        for(size_t i=b;i<e;++i){
+            double tr = 0, tt = 0;
+            for(int k=sedge_off[i];k<sedge_off[i+1];++k){
+                int x = sedge_members[k];
+                double m = edge_traffic(x);
+                tr += m - 1.0; tt += edges[x].freeflow_time_s * m;
+            }
+            cost_terms.traffic[i] = tr; sedge_time[i] = tt;
+        }
+    });
+    apply_cost_weights(current_weights(), sedge_cost);
+    for(auto &p: profiles) if(p.in_use) apply_cost_weights(p.w, p.cost);
+}
+
+// standing query (--watch): keep the shortest-path tree from src and repair it
+// per updates file instead of searching again. Only search edges whose update
+// objects changed are recosted (refresh_costs). Then, Ramalingam-Reps style:
+// the subtree hanging below every tree edge that got dearer (or blocked)
+// loses its distances, each node in it restarts from its best neighbour
+// outside, heads of cheaper edges that now beat their distance are queued,
+// and one Dijkstra pass settles the affected region. Untouched parts of the
+// tree are never visited. --simplify decisions are kept from the first file.
+struct ShortestPathTree {
+    int src = -1;
+    vector<double> dist;
+    vector<int> par, par_e; // tree parent and the search edge to it, -1 at src/unreached
+};
+struct SptRepair { size_t changed = 0, invalidated = 0, settled = 0; };
+
+// full Dijkstra, also the reference the repair has to agree with
+void build_spt(ShortestPathTree &t, int src) {
+    TraceScope ts("build_spt");
+    size_t n = adj.size();
+    t.src = src;
+    t.dist.assign(n, SearchWorkspace::INF); t.par.assign(n, -1); t.par_e.assign(n, -1);
+    vector<pair<double,int>> hp{{0.0, src}};
+    auto cmp = greater<pair<double,int>>();
+    t.dist[src] = 0.0;
+    while(!hp.empty()){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        auto [d, u] = hp.back(); hp.pop_back();
+        if(d > t.dist[u]) continue;
+        for(auto &a: adj[u]){
+            double c = sedge_cost[a.ei];
+            if(c >= 1e6) continue; // blocked
+            if(d + c + 1e-9 < t.dist[a.to]) {
+                t.dist[a.to] = d + c; t.par[a.to] = u; t.par_e[a.to] = a.ei;
+                hp.push_back({d + c, a.to}); push_heap(hp.begin(), hp.end(), cmp);
+            }
+        }
+    }
+}
+
+// sedge_cost already holds the new costs; old_cost[k] is the cost of changed[k] before
+SptRepair repair_spt(ShortestPathTree &t, const vector<int> &changed, const vector<double> &old_cost) {
+    TraceScope ts("repair_spt");
+    const double INF = SearchWorkspace::INF;
+    SptRepair r;
+    r.changed = changed.size();
+    auto cost = [INF](int ei){ double c = sedge_cost[ei]; return c >= 1e6 ? INF : c; };
+    vector<pair<double,int>> hp;
+    auto cmp = greater<pair<double,int>>();
+    auto push = [&](int v){ hp.push_back({t.dist[v], v}); push_heap(hp.begin(), hp.end(), cmp); };
+    // 1. cut the subtrees below dearer tree edges
+    vector<int> cut;
+    vector<char> in_cut(adj.size(), 0);
+    for(size_t k=0;k<changed.size();++k){
+        int ei = changed[k];
+        if(cost(ei) <= old_cost[k]) continue;
+        for(int v : {sedges[ei].u, sedges[ei].v})
+            if(t.par_e[v] == ei && !in_cut[v]) { in_cut[v] = 1; cut.push_back(v); }
+    }
+    for(size_t h=0; h<cut.size(); ++h){
+        int u = cut[h];
+        for(auto &a: adj[u]) if(t.par[a.to] == u && t.par_e[a.to] == a.ei && !in_cut[a.to]) { in_cut[a.to] = 1; cut.push_back(a.to); }
+    }
+    for(int v : cut) { t.dist[v] = INF; t.par[v] = -1; t.par_e[v] = -1; }
+    r.invalidated = cut.size();
+    // 2. every cut node restarts from its best neighbour outside the cut
+    const CSR &radj_ = rev_adj();
+    for(int v : cut){
+        for(auto &a: radj_[v]){
+            if(in_cut[a.to]) continue;
+            double nd = t.dist[a.to] + cost(a.ei);
+            if(nd + 1e-9 < t.dist[v]) { t.dist[v] = nd; t.par[v] = a.to; t.par_e[v] = a.ei; }
+        }
+        if(t.dist[v] < INF) push(v);
+    }
+    // 3. cheaper edges may now shorten the way to their head
+    for(size_t k=0;k<changed.size();++k){
+        int ei = changed[k];
+        if(cost(ei) >= old_cost[k]) continue;
+        for(int u : {sedges[ei].u, sedges[ei].v}){
+            if(t.dist[u] >= INF) continue;
+            for(auto &a: adj[u]) if(a.ei == ei && t.dist[u] + cost(ei) + 1e-9 < t.dist[a.to]) {
+                t.dist[a.to] = t.dist[u] + cost(ei); t.par[a.to] = u; t.par_e[a.to] = ei; push(a.to);
+            }
+        }
+    }
+    // 4. settle the affected region
+    while(!hp.empty()){
+        pop_heap(hp.begin(), hp.end(), cmp);
+        auto [d, u] = hp.back(); hp.pop_back();
+        if(d > t.dist[u]) continue;
+        r.settled++;
+        for(auto &a: adj[u]){
+            double c = cost(a.ei);
+            if(d + c + 1e-9 < t.dist[a.to]) { t.dist[a.to] = d + c; t.par[a.to] = u; t.par_e[a.to] = a.ei; push(a.to); }
+        }
+    }
+    if(collect_stats) add_search_stats(r.settled, 0, 0, 0);
+    if(ts.on) ts.args = "{\"invalidated\":" + to_string(r.invalidated) + ",\"settled\":" + to_string(r.settled) + "}";
+    return r;
+}
+
+vector<int> spt_route(const ShortestPathTree &t, int tgt) {
+    if(t.dist[tgt] >= SearchWorkspace::INF) return {};
+    vector<int> r;
+    for(int cur = tgt; cur != -1; cur = t.par[cur]) r.push_back(cur);
+    reverse(r.begin(), r.end());
+    return r;
+}
+
+// search edges whose members' update objects differ between two updates maps
+vector<int> changed_sedges(const unordered_map<int, json> &before, const unordered_map<int, json> &after) {
+    TraceScope ts("changed_sedges");
+    unordered_set<int> ids;
+    for(auto &kv : after) { auto it = before.find(kv.first); if(it == before.end() || it->second != kv.second) ids.insert(kv.first); }
+    for(auto &kv : before) if(!after.count(kv.first)) ids.insert(kv.first);
+    vector<int> out;
+    for(size_t i=0;i<sedges.size();++i)
+        for(int k=sedge_off[i];k<sedge_off[i+1];++k) if(ids.count(edges[sedge_members[k]].edge_id)) { out.push_back(i); break; }
+    return out;
+}
+
+int run_watch(const string &start, const string &dest, const vector<string> &files, bool simplify) {
+    int src = resolve_node(start), tgt = resolve_node(dest);
+    if(src == -1 || tgt == -1) { cerr << "Start or dest node not found\n"; return 1; }
+    prepare_graph({src, tgt}, simplify);
+    ShortestPathTree t;
+    { PhaseTimer pt(phase_times.search_ms); build_spt(t, src); }
+    vector<int> route = spt_route(t, tgt), arcs = route_arcs(route);
+    cout << fixed << setprecision(3) << "\nWatching " << start << " -> " << dest << ": ";
+    if(route.empty()) cout << "no route\n";
+    else cout << "Cost = " << t.dist[tgt] << " | Distance = " << route_distance(route)/1000.0 << " km\n";
+    for(auto &fn : files){
+        unordered_map<int, json> before = move(updates_by_edge);
+        if(!load_updates(fn)) { cerr << "Cannot load updates " << fn << "\n"; return 1; }
+        stat_clock::time_point t0 = stat_clock::now();
+        vector<int> ch = changed_sedges(before, updates_by_edge);
+        stat_clock::time_point t1 = stat_clock::now();
+        vector<double> old_cost(ch.size());
+        for(size_t k=0;k<ch.size();++k) old_cost[k] = sedge_cost[ch[k]] >= 1e6 ? SearchWorkspace::INF : sedge_cost[ch[k]];
+        refresh_costs(ch);
+        SptRepair rep;
+        { PhaseTimer pt(phase_times.search_ms); rep = repair_spt(t, ch, old_cost); }
+        double diff_ms = chrono::duration<double, milli>(t1 - t0).count();
+        double ms = chrono::duration<double, milli>(stat_clock::now() - t1).count();
+        vector<int> nr = spt_route(t, tgt), na = route_arcs(nr);
+        cout << fn << ": " << rep.changed << " search edges changed (diff " << diff_ms << " ms), " << rep.invalidated << " nodes cut, "
+             << rep.settled << " settled, repaired in " << ms << " ms | ";
+        if(nr.empty()) cout << "no route\n";
+        else cout << (na == arcs && !route.empty() ? "route unchanged" : "ROUTE CHANGED") << " | Cost = " << t.dist[tgt]
+                  << " | Distance = " << route_distance(nr)/1000.0 << " km\n";
+        route = nr; arcs = na;
+    }
+    if(route.empty()) return 1;
+    write_path_json({route}, "path.json");
+    return 0;
+}
+
+// route subscriptions (--batch requests --watch u1.json,..): every request's
+// best route stays registered, search edge by search edge, in an inverted
+// index. Per updates file only the routes on changed search edges are looked
+// at: their cost is summed again over the edges they already use, and only a
+// route that got dearer than (1 + reroute_pct/100) x the cost it was chosen
+// at, or blocked, is searched again. Changes go out as one NDJSON line per
+// route. K is ignored here, a subscription follows the best route only.
+struct Subscription {
+    BatchRequest req;
+    const vector<double> *cost = nullptr;
+    vector<int> route, arcs;    // nodes and the search edges between them
+    double chosen = 0, now = 0; // cost when routed, cost under the current updates
+};
+
+double arcs_cost(const vector<int> &arcs, const vector<double> &cost) {
+    double c = 0;
+    for(int ei : arcs) { if(cost[ei] >= 1e6) return SearchWorkspace::INF; c += cost[ei]; }
+    return c;
+}
+
+struct RouteIndex {
+    vector<vector<int>> subs; // search edge -> subscriptions on it
+    void add(int s, const vector<int> &arcs) { for(int ei : arcs) subs[ei].push_back(s); }
+    void remove(int s, const vector<int> &arcs) {
+        for(int ei : arcs) { auto &v = subs[ei]; auto it = find(v.begin(), v.end(), s); if(it != v.end()) { *it = v.back(); v.pop_back(); } }
+    }
+};
+
+void route_subscription(Subscription &s) {
+    s.route = s.req.src == -1 || s.req.tgt == -1 ? vector<int>{} : dijkstra_path(local_workspace(), s.req.src, s.req.tgt, {}, *s.cost);
+    s.arcs = route_arcs(s.route, *s.cost);
+    s.chosen = s.now = s.route.empty() ? SearchWorkspace::INF : arcs_cost(s.arcs, *s.cost);
+}
+
+json subscription_json(const Subscription &s, const char *event) {
+    json j;
+    j["id"] = s.req.id; j["event"] = event;
+    if(!s.req.profile.empty()) j["profile"] = s.req.profile;
+    if(!s.req.error.empty()) { j["error"] = s.req.error; return j; }
+    if(s.route.empty()) { j["error"] = "no route"; return j; }
+    j["cost"] = s.now;
+    j["route"] = route_json(s.route, 0, *s.cost);
+    return j;
+}
+
+int run_subscriptions(const string &batch_file, const string &out_file, const vector<string> &files, double reroute_pct, bool simplify) {
+    vector<BatchRequest> reqs;
+    if(!read_batch(batch_file, reqs)) { cerr << "Cannot read batch " << batch_file << "\n"; return 1; }
+    vector<int> endpoints;
+    vector<Subscription> subs(reqs.size());
+    for(size_t i=0;i<reqs.size();++i){
+        BatchRequest &r = reqs[i];
+        if(r.error.empty()) { r.src = resolve_node(r.start); r.tgt = resolve_node(r.dest); }
+        endpoints.push_back(r.src); endpoints.push_back(r.tgt);
+        if(Profile *p = find_profile(r.profile)) p->in_use = true;
+        subs[i].req = r;
+    }
+    prepare_graph(endpoints, simplify);
+    ofstream fo;
+    if(!out_file.empty()) { fo.open(out_file); if(!fo) { cerr << "Cannot write " << out_file << "\n"; return 1; } }
+    ostream &os = out_file.empty() ? cout : fo;
+    for(auto &s : subs){
+        s.cost = profile_cost(s.req.profile);
+        if(!s.cost) { cerr << "subscribe: unknown profile " << s.req.profile << " for " << s.req.id << "\n"; s.cost = &sedge_cost; s.req.src = -1; }
+    }
+    RouteIndex index;
+    index.subs.resize(sedges.size());
+    {
+        PhaseTimer pt(phase_times.search_ms);
+        pool_for(engine_pool, subs.size(), [&](size_t i){ route_subscription(subs[i]); });
+    }
+    for(size_t i=0;i<subs.size();++i){ index.add((int)i, subs[i].arcs); os << subscription_json(subs[i], "subscribed").dump() << "\n"; }
+    cerr << fixed << setprecision(3);
+    vector<int> stamp(subs.size(), -1);
+    for(int f=0; f<(int)files.size(); ++f){
+        unordered_map<int, json> before = move(updates_by_edge);
+        if(!load_updates(files[f])) { cerr << "Cannot load updates " << files[f] << "\n"; return 1; }
+        stat_clock::time_point t0 = stat_clock::now();
+        vector<int> ch = changed_sedges(before, updates_by_edge);
+        refresh_costs(ch);
+        // every subscription on a changed edge, once, and those without a route yet
+        vector<int> touched;
+        for(int ei : ch) for(int s : index.subs[ei]) if(stamp[s] != f) { stamp[s] = f; touched.push_back(s); }
+        if(!ch.empty()) for(size_t s=0;s<subs.size();++s) if(subs[s].route.empty() && subs[s].req.src != -1 && subs[s].req.tgt != -1) touched.push_back(s);
+        sort(touched.begin(), touched.end());
+        vector<int> reroute;
+        vector<double> was(subs.size());
+        for(int s : touched){
+            Subscription &sub = subs[s];
+            was[s] = sub.now;
+            if(sub.route.empty()) { reroute.push_back(s); continue; }
+            sub.now = arcs_cost(sub.arcs, *sub.cost);
+            if(sub.now > sub.chosen * (1.0 + reroute_pct / 100.0)) reroute.push_back(s);
+        }
+        vector<vector<int>> old_arcs(reroute.size());
+        for(size_t k=0;k<reroute.size();++k) old_arcs[k] = subs[reroute[k]].arcs;
+        {
+            PhaseTimer pt(phase_times.search_ms);
+            pool_for(engine_pool, reroute.size(), [&](size_t k){ route_subscription(subs[reroute[k]]); });
+        }
+        vector<char> searched(subs.size(), 0); // 1 searched, 2 searched and moved
+        size_t moved = 0;
+        for(size_t k=0;k<reroute.size();++k){
+            int s = reroute[k];
+            searched[s] = 1;
+            if(subs[s].arcs == old_arcs[k]) continue; // same nodes can still mean another parallel arc
+            index.remove(s, old_arcs[k]); index.add(s, subs[s].arcs);
+            searched[s] = 2; moved++;
+        }
+        double ms = chrono::duration<double, milli>(stat_clock::now() - t0).count();
+        for(int s : touched){
+            Subscription &sub = subs[s];
+            if(searched[s] != 2 && sub.now == was[s]) continue;
+            json j;
+            if(searched[s] == 2) j = subscription_json(sub, "rerouted");
+            else { j["id"] = sub.req.id; j["event"] = "cost"; j["cost"] = sub.now; j["searched"] = searched[s] != 0; }
+            j["update"] = files[f]; j["previous_cost"] = was[s];
+            os << j.dump() << "\n";
+        }
+        cerr << files[f] << ": " << ch.size() << " search edges changed, " << touched.size() << " of " << subs.size() << " routes touched, "
+             << reroute.size() << " searched, " << moved << " moved in " << ms << " ms\n";
+    }
+    os.flush();
+    return 0;
+}
+
+#ifndef SAFEPATH_NO_MAIN // safepath_bench.cpp includes this file for the engine only
+int main(int argc, char** argv) {
+    vector<string> args;
+    bool simplify = false, show_components = false;
+    string trace_file, batch_file, out_file, matrix_sources, matrix_targets_file, matrix_out = "matrix.csv", matrix_mode = "search", nearest_tag;
+    bool inbound = false, by_time = true;
+    double iso_budget = -1;
+    string all_out, all_mode = "phast";
+    vector<string> snapshots;
+    string profiles_file, profile_name = "balanced";
+    vector<string> compare;
+    bool pareto = false;
+    double pareto_eps = 0.02;
+    double max_slower = -1;
+    string td_file, td_mode = "astar";
+    double depart = -1;
+    string history_file, history_out;
+    long history_slot = -1;
+    vector<string> watch;
+    double reroute_pct = 5;
+    int threads = max(1u, thread::hardware_concurrency());
+    for(int i=1;i<argc;++i){
+        string a = argv[i];
+        if(a == "--directed") directed = true; // respect edges.csv oneway column
+        else if(a == "--simplify") simplify = true; // collapse parallel edges, contract degree-2 chains
+        else if(a == "--components") show_components = true; // component sizes on stderr
+        else if(a == "--stats") collect_stats = true; // search counters + phase times, stderr and path.json
+        else if(a == "--trace" && i+1 < argc) { tracing = true; trace_file = argv[++i]; } // chrome trace json
+        else if(a == "--batch" && i+1 < argc) batch_file = argv[++i]; // CSV / NDJSON of (start, dest, K)
+        else if(a == "--out" && i+1 < argc) out_file = argv[++i];     // batch results (default stdout)
+        else if(a == "--threads" && i+1 < argc) threads = stoi(argv[++i]); // batch + spur search threads
+        else if(a == "--matrix" && i+2 < argc) { matrix_sources = argv[++i]; matrix_targets_file = argv[++i]; } // node lists
+        else if(a == "--matrix-out" && i+1 < argc) matrix_out = argv[++i];   // .csv or .bin
+        else if(a == "--matrix-mode" && i+1 < argc) matrix_mode = argv[++i]; // search | buckets
+        else if(a == "--nearest" && i+1 < argc) nearest_tag = argv[++i]; // k nearest nodes with this tag from start
+        else if(a == "--inbound") inbound = true; // --nearest: facility -> start instead of start -> facility
+        else if(a == "--isochrone" && i+1 < argc) iso_budget = stod(argv[++i]); // everything within budget of start
+        else if(a == "--budget-metric" && i+1 < argc) by_time = string(argv[++i]) != "cost"; // time (s, default) | cost
+        else if(a == "--profiles" && i+1 < argc) profiles_file = argv[++i]; // named weight profiles (json)
+        else if(a == "--profile" && i+1 < argc) profile_name = argv[++i];   // default profile (batch lines may override)
+        else if(a == "--compare" && i+1 < argc) {                             // fastest,safest: best route per profile, one search
+            stringstream ss(argv[++i]); string nm;
+            while(getline(ss, nm, ',')) if(!nm.empty()) compare.push_back(nm);
+        }
+        else if(a == "--pareto") pareto = true;                              // every route not beaten on distance, time and safety
+        else if(a == "--pareto-eps" && i+1 < argc) pareto_eps = stod(argv[++i]); // routes within 1+eps count as equal (default 0.02, 0 = exact)
+        else if(a == "--max-slower" && i+1 < argc) max_slower = stod(argv[++i]); // safest route at most PCT % slower than the fastest
+        else if(a == "--td-profiles" && i+1 < argc) td_file = argv[++i]; // per-edge multiplier over the day (json)
+        else if(a == "--depart" && i+1 < argc) {                            // HH:MM[:SS] or seconds: time-dependent fastest route
+            depart = parse_clock(argv[++i]);
+            if(depart < 0) { cerr << "Bad --depart " << argv[i] << "\n"; return 1; }
+        }
+        else if(a == "--td-mode" && i+1 < argc) td_mode = argv[++i];        // astar | dijkstra
+        else if(a == "--history-build" && i+1 < argc) history_out = argv[++i]; // compress --snapshots (one per slot) into a store
+        else if(a == "--history" && i+1 < argc) history_file = argv[++i];     // traffic from a store slot instead of updates.json
+        else if(a == "--slot" && i+1 < argc) history_slot = stol(argv[++i]);
+        else if(a == "--watch" && i+1 < argc) {                             // u1.json,u2.json: repair the route's tree per file
+            stringstream ss(argv[++i]); string fn;
+            while(getline(ss, fn, ',')) if(!fn.empty()) watch.push_back(fn);
+        }
+        else if(a == "--reroute-pct" && i+1 < argc) reroute_pct = stod(argv[++i]); // --batch --watch: search again once a route is PCT % dearer
+        else if(a == "--one-to-all" && i+1 < argc) all_out = argv[++i];       // distances to every node, .csv or .bin
+        else if(a == "--one-to-all-mode" && i+1 < argc) all_mode = argv[++i]; // phast | dijkstra
+        else if(a == "--snapshots" && i+1 < argc) {                           // a.json,b.json: one-to-all per snapshot, or history slots
+            stringstream ss(argv[++i]); string fn;
+            while(getline(ss, fn, ',')) if(!fn.empty()) snapshots.push_back(fn);
+        }
+        else args.push_back(a);
+    }
+    bool service_mode = !batch_file.empty() || !matrix_sources.empty() || !history_out.empty();
+    if(args.size() < (service_mode ? 3u : nearest_tag.empty() && iso_budget < 0 && all_out.empty() ? 5u : 4u)
+       || (matrix_mode != "search" && matrix_mode != "buckets") || (all_mode != "phast" && all_mode != "dijkstra")
+       || (td_mode != "astar" && td_mode != "dijkstra") || (!history_file.empty() && history_slot < 0)) {
+        cerr<<"Usage: safepath_core nodes.csv edges.csv updates.json \"start_name\" \"dest_name\" [K] [--directed] [--simplify] [--components] [--stats] [--trace trace.json] [--threads N] [--profiles p.json] [--profile name] [--compare p1,p2,..] [--pareto [--pareto-eps E]] [--max-slower PCT] [--depart HH:MM [--td-profiles p.json] [--td-mode astar|dijkstra]] [--history store.sph --slot N] [--watch u1.json,u2.json,..]\n"
+              "       safepath_core nodes.csv edges.csv updates.json --batch requests.csv|.ndjson [--out results.ndjson] [--threads N] [--watch u1.json,.. [--reroute-pct PCT]] [options]\n"
+              "       safepath_core nodes.csv edges.csv updates.json --matrix sources.txt targets.txt [--matrix-out matrix.csv|.bin] [--matrix-mode search|buckets] [options]\n"
+              "       safepath_core nodes.csv edges.csv updates.json \"incident\" [k] --nearest TAG [--inbound] [options]\n"
+              "       safepath_core nodes.csv edges.csv updates.json \"start\" --isochrone BUDGET [--budget-metric time|cost] [options]\n"
+              "       safepath_core nodes.csv edges.csv updates.json --history-build store.sph --snapshots u0.json,u1.json,..\n"
+              "       safepath_core nodes.csv edges.csv updates.json \"start\" --one-to-all dist.csv|.bin [--one-to-all-mode phast|dijkstra] [--snapshots u1.json,u2.json] [options]\n";
+        return 1;
+    }
+    string nodes_file = args[0], edges_file = args[1], updates_file = args[2];
+    if(!profiles_file.empty() && !load_profiles(profiles_file)) { cerr << "Cannot load profiles " << profiles_file << "\n"; return 1; }
+    if(!use_profile(profile_name)) { cerr << "Unknown profile " << profile_name << "\n"; return 1; }
+
+    {
+        PhaseTimer pt(phase_times.load_ms);
+        if(!load_nodes(nodes_file)) { cerr<<"Cannot load nodes\n"; return 1; }
+        if(!load_edges(edges_file)) { cerr<<"Cannot load edges\n"; return 1; }
+        if(!load_updates(updates_file)) { cerr<<"Cannot load updates\n"; return 1; }
+        if(!td_file.empty() && !load_td_profiles(td_file)) { cerr << "Cannot load td profiles " << td_file << "\n"; return 1; }
+        if(!history_file.empty() && !load_history_slice(history_file, (uint32_t)history_slot)) {
+            cerr << "Cannot read slot " << history_slot << " of " << history_file << "\n"; return 1;
+        }
+    }
+    if(!history_out.empty()) return run_history_build(history_out, snapshots);
+    unique_ptr<ThreadPool> pool;
+    if(threads > 1) { pool.reset(new ThreadPool(threads)); engine_pool = pool.get(); }
+    // every mode leaves through here: stats and trace after its own output
+    auto finish = [&](int rc){
+        if(collect_stats) print_stats(cerr);
+        if(tracing && !write_trace(trace_file)) { cerr << "Cannot write " << trace_file << "\n"; return 1; }
+        return rc;
+    };
+    if(!batch_file.empty())
+        return finish(watch.empty() ? run_batch(batch_file, out_file, simplify, threads)
+                                    : run_subscriptions(batch_file, out_file, watch, reroute_pct, simplify));
+    if(!matrix_sources.empty()) return finish(run_matrix(matrix_sources, matrix_targets_file, matrix_out, matrix_mode, simplify));
+    if(!nearest_tag.empty()) return finish(run_nearest(nearest_tag, args[3], args.size() >= 5 ? stoi(args[4]) : 1, inbound, simplify));
+    if(iso_budget >= 0) return finish(run_isochrone(args[3], iso_budget, by_time, simplify));
+    if(!all_out.empty()) {
+        if(simplify) cerr << "one-to-all: --simplify ignored, every node is a target\n";
+        return finish(run_one_to_all(args[3], all_out, all_mode, snapshots));
+    }
+    if(!compare.empty()) return finish(run_multi_profile(args[3], args[4], compare, simplify));
+    if(pareto) return finish(run_pareto(args[3], args[4], pareto_eps, simplify));
+    if(max_slower >= 0) return finish(run_constrained(args[3], args[4], max_slower, simplify));
+    if(!watch.empty()) return finish(run_watch(args[3], args[4], watch, simplify));
+    if(depart >= 0) return finish(run_time_dependent(args[3], args[4], depart, td_mode == "astar", simplify));
+    string start_name = args[3], dest_name = args[4];
+    int K = 3;
+    if(args.size() >= 6) K = stoi(args[5]);
+
+    int src = find_node_id_by_name(start_name);
+    int tgt = find_node_id_by_name(dest_name);
+    if(src==-1 || tgt==-1) {
+        cerr<<"Start or dest node not found. Use exact name from nodes.csv\n";
+        for(uint32_t id=0; id<names.size(); ++id) cerr << names.get(id) << "\n";
+        return 1;
+    }
+    prepare_graph({src, tgt}, simplify);
+    if(show_components) {
+        vector<int> sz = comp_size;
+        sort(sz.rbegin(), sz.rend());
+        cerr << "components: " << comp_size.size() << " weak, largest:";
+        for(size_t i=0;i<sz.size() && i<5;++i) cerr << " " << sz[i];
+        cerr << "\n";
+        if(directed) cerr << "components: " << scc_size.size() << " strong\n";
+        cerr << "components: start in weak #" << comp_id[src] << " (" << comp_size[comp_id[src]] << " nodes, strong "
+             << scc_size[scc_id[src]] << "), dest in weak #" << comp_id[tgt] << " (" << comp_size[comp_id[tgt]] << " nodes, strong "
+             << scc_size[scc_id[tgt]] << ")\n";
+    }
+
+    auto routes = k_short_simple(src,tgt,K);
+    if(routes.empty()) { cerr<<"No routes found\n"; return 1; }
+
+    // print reasons - compare to best
+    {
+        PhaseTimer pt(phase_times.output_ms);
+        vector<vector<int>> allroutes;
+        for(auto &r: routes) allroutes.push_back(expand_route(r));
+        double best_m = route_distance(routes[0]);
+        cout << fixed << setprecision(3);
+        cout << "\nTop " << allroutes.size() << " routes from " << start_name << " -> " << dest_name << ":\n";
+        for(size_t i=0;i<allroutes.size();++i) {
+            double total_m = route_distance(routes[i]);
+            cout << i+1 << ") Distance = " << (total_m/1000.0) << " km | Hops = " << (allroutes[i].size()-1) << " | Path: ";
+            for(size_t k=0;k<allroutes[i].size();++k){
+                cout << node_name(allroutes[i][k]);
+                if(k+1<allroutes[i].size()) cout << " -> ";
+            }
+            cout << "\n";
+            if(i>0) {
+                // simple reasoning
+                double diff_km = (total_m - best_m) / 1000.0;
+                cout << "  -> Why not preferred: Longer than best by " << diff_km << " km.";
+                if(allroutes[i].size() > allroutes[0].size()) cout << " More hops (" << (allroutes[i].size()-1) << " vs " << (allroutes[0].size()-1) << ").";
+                cout << "\n";
+            } else {
+                cout << "  -> Chosen as BEST route (composite score).\n";
+            }
+        }
+    }
+
+    // write path.json for viewer
+    write_path_json(routes, "path.json");
+    cout << "Wrote path.json\n";
+    return finish(0);
 }
+#endif